@@ -0,0 +1,456 @@
+#define EXCHANGE_NO_MAIN
+#include "Project.cpp"
+#include <algorithm>
+
+const size_t BENCHMARK_NAME_LENGTH = 32;
+const double MIN_WALLET_COINS = 10;
+const double MAX_WALLET_COINS = 1000;
+
+struct BenchmarkOptions {
+    enum class SizeDistribution { UNIFORM, EXPONENTIAL };
+    size_t wallets;
+    size_t transfers;
+    size_t orders;
+    size_t investorQueries;
+    size_t saveLoadIterations;
+    double buyRatio;
+    double priceSpread;
+    SizeDistribution sizeDistribution;
+    double minSize;
+    double maxSize;
+    double meanSize;
+    double transferRate;
+    unsigned long long seed;
+    const char* directory;
+    const char* outputFilename;
+    bool json;
+    StartupOptions startup;
+};
+
+struct BenchmarkResult {
+    const char* name;
+    size_t iterations;
+    size_t failed;
+    long long totalTime;
+    long long* samples;
+    size_t fills;
+};
+
+struct Workload {
+    char* names;
+    double* fiatMoney;
+    unsigned* walletIds;
+    size_t* senders;
+    size_t* receivers;
+    double* transferAmounts;
+    size_t* orderWallets;
+    bool* orderBuys;
+    double* orderSizes;
+    double* orderPrices;
+};
+
+double generateSize(const BenchmarkOptions& options, std::mt19937_64& random) {
+    double size;
+    if (options.sizeDistribution == BenchmarkOptions::SizeDistribution::EXPONENTIAL) {
+        size = std::exponential_distribution<double>(1 / options.meanSize)(random);
+    }
+    else {
+        size = std::uniform_real_distribution<double>(options.minSize, options.maxSize)(random);
+    }
+    if (size < options.minSize) {
+        size = options.minSize;
+    }
+    if (size > options.maxSize) {
+        size = options.maxSize;
+    }
+    return floor(size * 100) / 100;
+}
+
+bool generateWorkload(Workload& workload, const BenchmarkOptions& options) {
+    std::mt19937_64 random(options.seed);
+    std::uniform_int_distribution<size_t> walletDistribution(0, options.wallets - 1);
+    std::uniform_real_distribution<double> coinsDistribution(MIN_WALLET_COINS, MAX_WALLET_COINS);
+    std::uniform_real_distribution<double> spreadDistribution(-options.priceSpread, options.priceSpread);
+    std::bernoulli_distribution buyDistribution(options.buyRatio);
+
+    workload.names = new (std::nothrow) char[options.wallets * BENCHMARK_NAME_LENGTH];
+    workload.fiatMoney = new (std::nothrow) double[options.wallets];
+    workload.walletIds = new (std::nothrow) unsigned[options.wallets];
+    workload.senders = new (std::nothrow) size_t[options.transfers];
+    workload.receivers = new (std::nothrow) size_t[options.transfers];
+    workload.transferAmounts = new (std::nothrow) double[options.transfers];
+    workload.orderWallets = new (std::nothrow) size_t[options.orders];
+    workload.orderBuys = new (std::nothrow) bool[options.orders];
+    workload.orderSizes = new (std::nothrow) double[options.orders];
+    workload.orderPrices = new (std::nothrow) double[options.orders];
+    if (workload.names == nullptr || workload.fiatMoney == nullptr || workload.walletIds == nullptr ||
+        workload.senders == nullptr || workload.receivers == nullptr || workload.transferAmounts == nullptr ||
+        workload.orderWallets == nullptr || workload.orderBuys == nullptr || workload.orderSizes == nullptr ||
+        workload.orderPrices == nullptr) {
+        return false;
+    }
+
+    for (size_t i = 0; i < options.wallets; i++) {
+        snprintf(workload.names + i * BENCHMARK_NAME_LENGTH, BENCHMARK_NAME_LENGTH, "trader%zu", i);
+        workload.fiatMoney[i] = floor(coinsDistribution(random) * EXCHANGE_RATE);
+    }
+    for (size_t i = 0; i < options.transfers; i++) {
+        workload.senders[i] = walletDistribution(random);
+        do {
+            workload.receivers[i] = walletDistribution(random);
+        }
+        while (options.wallets > 1 && workload.receivers[i] == workload.senders[i]);
+        workload.transferAmounts[i] = generateSize(options, random);
+    }
+    for (size_t i = 0; i < options.orders; i++) {
+        workload.orderWallets[i] = walletDistribution(random);
+        workload.orderBuys[i] = buyDistribution(random);
+        workload.orderSizes[i] = generateSize(options, random);
+        workload.orderPrices[i] = floor(EXCHANGE_RATE * (1 + spreadDistribution(random)) * 100) / 100;
+    }
+    return true;
+}
+
+void releaseWorkload(Workload& workload) {
+    delete[] workload.names;
+    delete[] workload.fiatMoney;
+    delete[] workload.walletIds;
+    delete[] workload.senders;
+    delete[] workload.receivers;
+    delete[] workload.transferAmounts;
+    delete[] workload.orderWallets;
+    delete[] workload.orderBuys;
+    delete[] workload.orderSizes;
+    delete[] workload.orderPrices;
+}
+
+template <typename Operation>
+void measure(BenchmarkResult& result, const char name[], const size_t iterations, const double rate,
+    Operation operation) {
+    result.name = name;
+    result.iterations = iterations;
+    result.failed = 0;
+    result.fills = 0;
+    result.samples = new (std::nothrow) long long[iterations > 0 ? iterations : 1];
+
+    long long startTime = getNanoseconds();
+    for (size_t i = 0; i < iterations; i++) {
+        long long begin = getNanoseconds();
+        if (rate > 0) {
+            long long scheduled = startTime + (long long)(i * 1e9 / rate);
+            while (begin < scheduled) {
+                std::this_thread::yield();
+                begin = getNanoseconds();
+            }
+            begin = scheduled;
+        }
+        if (!operation(i)) {
+            result.failed++;
+        }
+        result.samples[i] = getNanoseconds() - begin;
+    }
+    result.totalTime = getNanoseconds() - startTime;
+    std::sort(result.samples, result.samples + iterations);
+}
+
+long long samplePercentile(const BenchmarkResult& result, const double percentile) {
+    if (result.iterations == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(percentile * result.iterations);
+    return result.samples[index < result.iterations ? index : result.iterations - 1];
+}
+
+double itemsPerSecond(const BenchmarkResult& result) {
+    return result.totalTime > 0 ? result.iterations * 1e9 / result.totalTime : 0;
+}
+
+size_t runBenchmarks(const BenchmarkOptions& options, const Workload& workload, BenchmarkResult results[]) {
+    size_t count = 0;
+    std::ostream discarded(nullptr);
+    System system;
+    loadSystem(system, options.startup);
+    // Measured like a --batch run, so the group-commit options apply and save is the durability point
+    system.journal.deferCommit = true;
+
+    measure(results[count++], "addWallet", options.wallets, 0, [&](const size_t i) {
+        long long walletId = addWallet(system, workload.fiatMoney[i], workload.names + i * BENCHMARK_NAME_LENGTH);
+        workload.walletIds[i] = (unsigned)walletId;
+        return walletId != -1;
+    });
+
+    measure(results[count++], "transfer", options.transfers, options.transferRate, [&](const size_t i) {
+        return transfer(system, workload.walletIds[workload.senders[i]], workload.walletIds[workload.receivers[i]],
+            workload.transferAmounts[i]);
+    });
+
+    size_t fills = system.fills.count;
+    measure(results[count], "addOrder", options.orders, 0, [&](const size_t i) {
+        return addOrder(system, workload.walletIds[workload.orderWallets[i]],
+            workload.orderBuys[i] ? Order::Type::BUY : Order::Type::SELL, workload.orderSizes[i],
+            workload.orderPrices[i]) != -1;
+    });
+    results[count++].fills = system.fills.count - fills;
+
+    measure(results[count++], "attractInvestors", options.investorQueries, 0, [&](const size_t) {
+        system.leaderboard.valid = false;
+        attractInvestors(system, discarded);
+        return system.leaderboard.valid;
+    });
+
+    measure(results[count++], "save", options.saveLoadIterations, 0, [&](const size_t) {
+        return quit(system);
+    });
+
+    // Loading truncates journal.dat to its replayed size, so it runs on a copy of the saved files
+    // while the system under test keeps the originals open and mapped
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::current_path(error);
+    std::filesystem::path loadDirectory = directory / "load";
+    std::filesystem::create_directories(loadDirectory, error);
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.is_regular_file()) {
+            std::filesystem::copy_file(entry.path(), loadDirectory / entry.path().filename(),
+                std::filesystem::copy_options::overwrite_existing, error);
+        }
+    }
+    std::filesystem::current_path(loadDirectory, error);
+
+    measure(results[count++], "load", options.saveLoadIterations, 0, [&](const size_t) {
+        System* loaded = new (std::nothrow) System;
+        if (loaded == nullptr) {
+            return false;
+        }
+        loadSystem(*loaded, options.startup);
+        bool loadedAll = loaded->wallets.count == system.wallets.count;
+        releaseSystem(*loaded);
+        delete loaded;
+        return loadedAll;
+    });
+    std::filesystem::current_path(directory, error);
+    releaseSystem(system);
+    return count;
+}
+
+void writeConsoleResults(std::ostream& output, const BenchmarkResult results[], const size_t count) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-18s %12s %8s %12s %10s %10s %10s %12s %14s",
+        "Benchmark", "Iterations", "Failed", "Time/op(ns)", "p50(ns)", "p99(ns)", "p999(ns)", "max(ns)", "items/s");
+    output << line << std::endl;
+    output << std::string(strlen(line), '-') << std::endl;
+    for (size_t i = 0; i < count; i++) {
+        const BenchmarkResult& result = results[i];
+        snprintf(line, sizeof(line), "%-18s %12zu %8zu %12lld %10lld %10lld %10lld %12lld %14.0f",
+            result.name, result.iterations, result.failed,
+            result.iterations > 0 ? result.totalTime / (long long)result.iterations : 0,
+            samplePercentile(result, 0.5), samplePercentile(result, 0.99), samplePercentile(result, 0.999),
+            result.iterations > 0 ? result.samples[result.iterations - 1] : 0, itemsPerSecond(result));
+        output << line << std::endl;
+    }
+}
+
+void writeJsonResults(std::ostream& output, const BenchmarkOptions& options, const BenchmarkResult results[],
+    const size_t count) {
+    char date[64];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    output << "{\"context\":{\"date\":\"" << date << "\",\"num_cpus\":" << std::thread::hardware_concurrency()
+        << ",\"library_build_type\":\"" <<
+#ifdef NDEBUG
+        "release"
+#else
+        "debug"
+#endif
+        << "\",\"wallets\":" << options.wallets << ",\"transfers\":" << options.transfers
+        << ",\"orders\":" << options.orders << ",\"buy_ratio\":" << options.buyRatio
+        << ",\"price_spread\":" << options.priceSpread << ",\"size_distribution\":\""
+        << (options.sizeDistribution == BenchmarkOptions::SizeDistribution::EXPONENTIAL ? "exponential" : "uniform")
+        << "\",\"transfer_rate\":" << options.transferRate << ",\"seed\":" << options.seed << "},\"benchmarks\":[";
+    for (size_t i = 0; i < count; i++) {
+        const BenchmarkResult& result = results[i];
+        output << (i > 0 ? "," : "") << "{\"name\":\"" << result.name << "\",\"iterations\":" << result.iterations
+            << ",\"failed\":" << result.failed << ",\"real_time\":"
+            << (result.iterations > 0 ? (double)result.totalTime / result.iterations : 0)
+            << ",\"time_unit\":\"ns\",\"items_per_second\":" << itemsPerSecond(result)
+            << ",\"p50\":" << samplePercentile(result, 0.5) << ",\"p99\":" << samplePercentile(result, 0.99)
+            << ",\"p999\":" << samplePercentile(result, 0.999)
+            << ",\"max\":" << (result.iterations > 0 ? result.samples[result.iterations - 1] : 0);
+        if (result.fills > 0) {
+            output << ",\"fills\":" << result.fills;
+        }
+        output << "}";
+    }
+    output << "]}" << std::endl;
+}
+
+void displayBenchmarkUsage() {
+    std::cout << "exchange_bench [options]" << std::endl;
+    std::cout << "--wallets **count**" << std::endl;
+    std::cout << "--transfers **count**" << std::endl;
+    std::cout << "--transfer-rate **perSecond**" << std::endl;
+    std::cout << "--orders **count**" << std::endl;
+    std::cout << "--buy-ratio **ratio**" << std::endl;
+    std::cout << "--price-spread **ratio**" << std::endl;
+    std::cout << "--size-distribution **uniform|exponential**" << std::endl;
+    std::cout << "--min-size **grnCoins** --max-size **grnCoins** --mean-size **grnCoins**" << std::endl;
+    std::cout << "--investor-queries **count**" << std::endl;
+    std::cout << "--save-load-iterations **count**" << std::endl;
+    std::cout << "--group-commit-count **records** --group-commit-window **milliseconds**" << std::endl;
+    std::cout << "--seed **seed**" << std::endl;
+    std::cout << "--directory **path**" << std::endl;
+    std::cout << "--format **console|json**" << std::endl;
+    std::cout << "--out **filename**" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    options.wallets = 100000;
+    options.transfers = 200000;
+    options.orders = 100000;
+    options.investorQueries = 1000;
+    options.saveLoadIterations = 3;
+    options.buyRatio = 0.5;
+    options.priceSpread = 0.02;
+    options.sizeDistribution = BenchmarkOptions::SizeDistribution::UNIFORM;
+    options.minSize = 0.01;
+    options.maxSize = 5;
+    options.meanSize = 1;
+    options.transferRate = 0;
+    options.seed = 1;
+    options.directory = nullptr;
+    options.outputFilename = nullptr;
+    options.json = false;
+    options.startup.threads = std::thread::hardware_concurrency();
+    options.startup.validateLedger = false;
+    options.startup.groupCommitCount = GROUP_COMMIT_COUNT;
+    options.startup.groupCommitWindow = GROUP_COMMIT_WINDOW;
+    options.startup.checkpointInterval = 0;
+    options.startup.listenPort = 0;
+    options.startup.socketPath = nullptr;
+    options.startup.batchFilename = nullptr;
+    options.startup.statsFilename = nullptr;
+    options.startup.idStrategy = IdAllocator::Strategy::RANDOM;
+    options.startup.seeded = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || i + 1 == argc) {
+            displayBenchmarkUsage();
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--wallets") == 0) {
+            options.wallets = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--transfers") == 0) {
+            options.transfers = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--transfer-rate") == 0) {
+            options.transferRate = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--orders") == 0) {
+            options.orders = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--buy-ratio") == 0) {
+            options.buyRatio = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--price-spread") == 0) {
+            options.priceSpread = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--size-distribution") == 0) {
+            options.sizeDistribution = strcmp(argv[++i], "exponential") == 0 ?
+                BenchmarkOptions::SizeDistribution::EXPONENTIAL : BenchmarkOptions::SizeDistribution::UNIFORM;
+        }
+        else if (strcmp(argv[i], "--min-size") == 0) {
+            options.minSize = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--max-size") == 0) {
+            options.maxSize = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--mean-size") == 0) {
+            options.meanSize = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--investor-queries") == 0) {
+            options.investorQueries = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--save-load-iterations") == 0) {
+            options.saveLoadIterations = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--group-commit-count") == 0) {
+            options.startup.groupCommitCount = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--group-commit-window") == 0) {
+            options.startup.groupCommitWindow = strtoll(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--directory") == 0) {
+            options.directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--format") == 0) {
+            options.json = strcmp(argv[++i], "json") == 0;
+        }
+        else if (strcmp(argv[i], "--out") == 0) {
+            options.outputFilename = argv[++i];
+        }
+        else {
+            displayBenchmarkUsage();
+            return 1;
+        }
+    }
+    options.startup.idSeed = options.seed;
+    if (options.wallets == 0 || options.minSize <= 0 || options.maxSize < options.minSize || options.meanSize <= 0) {
+        std::cout << "Invalid workload parameters" << std::endl;
+        return 1;
+    }
+
+    Workload workload;
+    if (!generateWorkload(workload, options)) {
+        std::cout << "Could not allocate the workload" << std::endl;
+        return 1;
+    }
+
+    std::error_code error;
+    std::filesystem::path initialDirectory = std::filesystem::current_path();
+    std::filesystem::path directory = options.directory != nullptr ? std::filesystem::path(options.directory) :
+        std::filesystem::temp_directory_path() / "exchange_bench";
+    std::filesystem::remove_all(directory, error);
+    std::filesystem::create_directories(directory, error);
+    std::filesystem::current_path(directory, error);
+    if (error) {
+        std::cout << "Could not use directory " << directory.string() << std::endl;
+        return 1;
+    }
+
+    BenchmarkResult results[8];
+    std::streambuf* console = std::cout.rdbuf(nullptr);
+    size_t count = runBenchmarks(options, workload, results);
+    std::cout.rdbuf(console);
+
+    std::filesystem::current_path(initialDirectory, error);
+    if (options.directory == nullptr) {
+        std::filesystem::remove_all(directory, error);
+    }
+
+    std::ofstream outputFile;
+    if (options.outputFilename != nullptr) {
+        outputFile.open(options.outputFilename);
+        if (!outputFile.is_open()) {
+            std::cout << "Could not open " << options.outputFilename << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& output = options.outputFilename != nullptr ? outputFile : std::cout;
+    if (options.json) {
+        writeJsonResults(output, options, results, count);
+    }
+    else {
+        writeConsoleResults(output, results, count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        delete[] results[i].samples;
+    }
+    releaseWorkload(workload);
+    return 0;
+}
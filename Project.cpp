@@ -1,7 +1,56 @@
 #include <iostream>
 #include <cstring>
 #include <fstream>
+#include <sstream>
 #include <ctime>
+#include <cstdio>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <limits>
+#include <condition_variable>
+#include <charconv>
+#include <climits>
+#include <random>
+#include <algorithm>
+#if defined(__x86_64__) || defined(_M_X64)
+#define LEDGER_AVX2_KERNELS
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#define EXCHANGE_SERVER
+#include <shared_mutex>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#endif
+
+#ifndef EXCHANGE_NO_STATS
+#define EXCHANGE_STATS
+#endif
 
 #pragma warning(disable: 4996)
 
@@ -10,22 +59,108 @@ const size_t INITIAL_CAPACITY = 2;
 const int EXCHANGE_RATE = 375;
 const int RICHEST_USERS_COUNT = 10;
 const size_t MAX_INPUT_LENGTH = 1024;
+const size_t EMPTY_SLOT = 0;
+const size_t NO_ORDER = (size_t)-1;
+const size_t HISTORY_PAGE_SIZE = 100;
+const size_t NET_FLOW_KERNEL_WALLETS = 8;
+const size_t REPORT_BUFFER_SIZE = 1 << 20;
+const size_t MAX_REPORT_FIELD_LENGTH = 2048;
+const size_t GROUP_COMMIT_COUNT = 64;
+const long long GROUP_COMMIT_WINDOW = 10;
+
+const size_t WALLET_SHARD_COUNT = 64;
+const size_t SERVER_QUEUE_CAPACITY = 1024;
+const size_t CONNECTION_BUFFER_SIZE = 4 * MAX_INPUT_LENGTH;
+const int MAX_SERVER_EVENTS = 64;
+const size_t BATCH_COMMAND_TABLE_SIZE = 32;
+const int HISTOGRAM_SUB_BUCKET_BITS = 4;
+const size_t HISTOGRAM_BUCKETS = 64 << HISTOGRAM_SUB_BUCKET_BITS;
+const size_t MARKET_BAR_COUNT = 1440;
+const size_t MARKET_INTERVAL_COUNT = 4;
+const long long MARKET_INTERVALS[MARKET_INTERVAL_COUNT] = { 60, 300, 3600, 86400 };
+const size_t RECENT_BAR_COUNT = 10;
 
 const char WALLETS_FILENAME[] = "wallets.dat";
 const char EXECUTED_ORDERS_FILENAME[] = "executed_orders.dat";
 const char TRANSACTIONS_FILENAME[] = "transactions.dat";
 const char ORDERS_FILENAME[] = "orders.dat";
+const char FILLS_FILENAME[] = "fills.dat";
+const char JOURNAL_FILENAME[] = "journal.dat";
+const char PREVIOUS_JOURNAL_FILENAME[] = "journal.old";
+const char SNAPSHOT_FILENAME[] = "snapshot.dat";
+const char BALANCES_FILENAME[] = "balances.dat";
+const char ORDERS_ARCHIVE_FILENAME[] = "orders_archive.dat";
+const char TRANSACTIONS_ARCHIVE_FILENAME[] = "transactions_archive.dat";
+const char FILLS_ARCHIVE_FILENAME[] = "fills_archive.dat";
+const char* const CHECKPOINT_FILENAMES[] = { WALLETS_FILENAME, EXECUTED_ORDERS_FILENAME, BALANCES_FILENAME, ORDERS_FILENAME };
+const size_t CHECKPOINT_FILE_COUNT = sizeof(CHECKPOINT_FILENAMES) / sizeof(CHECKPOINT_FILENAMES[0]);
+const char LEDGER_MAGIC[8] = { 'G', 'R', 'N', 'L', 'E', 'D', 'G', 'R' };
+const unsigned LEDGER_VERSION = 2;
+const unsigned LEGACY_LEDGER_VERSION = 1;
+const size_t LEDGER_BLOCK_SIZE = 4096;
+const size_t CHUNK_SIZE = LEDGER_BLOCK_SIZE;
+const size_t SLAB_CHUNKS = 16;
+const char WALLETS_MAGIC[8] = { 'G', 'R', 'N', 'W', 'A', 'L', 'L', 'T' };
+const unsigned WALLETS_VERSION = 2;
+const char ORDERS_MAGIC[8] = { 'G', 'R', 'N', 'O', 'R', 'D', 'R', 'S' };
+const unsigned ORDERS_VERSION = 3;
+const unsigned LEGACY_ORDERS_VERSION = 2;
+const char ARCHIVE_MAGIC[8] = { 'G', 'R', 'N', 'A', 'R', 'C', 'H', 'V' };
+const unsigned ARCHIVE_VERSION = 1;
+const unsigned long long LEDGER_CHECKSUM_SEED = 14695981039346656037ull;
+const unsigned long long UNBOUNDED_COUNT = ~0ull;
 
 struct Wallet {
-    char owner[256];
     unsigned id;
+    unsigned ownerOffset;
     double fiatMoney;
 };
 
+struct NameArena {
+    char* items;
+    size_t count, capacity;
+    size_t* index;
+    size_t indexCapacity;
+    size_t names;
+};
+
+struct WalletsHeader {
+    char magic[8];
+    unsigned version;
+    unsigned recordSize;
+    unsigned long long count;
+    unsigned long long namesSize;
+};
+
+struct WalletHistory {
+    size_t* positions;
+    size_t count, capacity;
+    size_t archivedCount;
+    long long archivedFirstTime, archivedLastTime;
+};
+
+struct WalletVolume {
+    double boughtCoins;
+    double soldCoins;
+    double fiatVolume;
+    size_t fills;
+};
+
 struct WalletContainer {
     Wallet* items;
     size_t* executedOrders;
+    double* coins;
+    double* reservedFiat;
+    double* reservedCoins;
+    WalletHistory* histories;
+    WalletVolume* volumes;
+    bool historiesIndexed;
+    bool archiveIndexed;
+    size_t carriedForward;
+    NameArena owners;
     size_t count, capacity;
+    size_t* index;
+    size_t indexCapacity;
 };
 
 struct Transaction {
@@ -35,551 +170,4868 @@ struct Transaction {
     double grnCoins;
 };
 
+struct LedgerHeader {
+    char magic[8];
+    unsigned version;
+    unsigned recordSize;
+    unsigned long long count;
+    unsigned long long checksum;
+    unsigned long long blockSize;
+};
+
+struct SnapshotHeader {
+    unsigned long long sequence;
+    unsigned long long ledgerCount;
+    unsigned long long ledgerChecksum;
+    unsigned long long fillCount;
+};
+
+struct ArchiveHeader {
+    char magic[8];
+    unsigned version;
+    unsigned recordSize;
+    unsigned long long count;
+    unsigned long long carryForwardCount;
+    long long watermark;
+    unsigned long long checksum;
+};
+
+struct FileSection {
+    const void* data;
+    size_t size;
+};
+
+struct CarryForward {
+    unsigned walletId;
+    double grnCoins;
+};
+
+struct ChunkPool {
+    size_t chunkBytes;
+    void* freeChunks;
+    char* slab;
+    size_t slabUsed;
+    std::mutex mutex;
+};
+
+template <typename T>
+struct ChunkedArray {
+    T** chunks;
+    size_t chunkCount, directoryCapacity;
+
+    T& operator[](const size_t position) {
+        return chunks[position / CHUNK_SIZE][position % CHUNK_SIZE];
+    }
+    const T& operator[](const size_t position) const {
+        return chunks[position / CHUNK_SIZE][position % CHUNK_SIZE];
+    }
+};
+
+struct TransferRequest {
+    unsigned senderId;
+    unsigned receiverId;
+    double grnCoins;
+};
+
+struct WalletDebit {
+    long long position;
+    double grnCoins;
+};
+
+struct LedgerColumns {
+    const long long* times;
+    const unsigned* senderIds;
+    const unsigned* receiverIds;
+    const double* grnCoins;
+    size_t count;
+};
+
 struct TransactionContainer {
-    Transaction* items;
+    const char* history;
+    size_t historyCount;
+    void* mappedView;
+    size_t mappedSize;
+    size_t persistedCount;
+    unsigned long long checksum;
+    ChunkedArray<long long> times;
+    ChunkedArray<unsigned> senderIds;
+    ChunkedArray<unsigned> receiverIds;
+    ChunkedArray<double> grnCoins;
     size_t count, capacity;
 };
 
 struct Order {
     enum Type { SELL, BUY } type;
+    unsigned long long id;
     unsigned walletId;
     double grnCoins;
+    double remainingCoins;
+    double price;
+};
+
+struct OrdersHeader {
+    char magic[8];
+    unsigned version;
+    unsigned recordSize;
+    unsigned long long count;
+    unsigned long long nextId;
 };
 
 struct OrdersContainer {
-    Order* items;
-    bool* executed;
+    ChunkedArray<Order> items;
+    ChunkedArray<bool> executed;
+    ChunkedArray<long long> times;
+    ChunkedArray<size_t> next;
+    ChunkedArray<size_t> previous;
+    size_t count, capacity;
+    unsigned long long nextId;
+};
+
+struct Fill {
+    long long time;
+    unsigned long long orderId;
+    unsigned long long counterpartyOrderId;
+    unsigned sellerId;
+    unsigned buyerId;
+    double grnCoins;
+    double price;
+};
+
+struct FillContainer {
+    ChunkedArray<Fill> items;
+    size_t count, capacity;
+    size_t persistedCount;
+};
+
+struct PriceLevel {
+    double price;
+    size_t head, tail;
+};
+
+struct OrderBook {
+    Order::Type side;
+    PriceLevel* levels;
     size_t count, capacity;
 };
 
+struct JournalRecord {
+    enum Type { ADD_WALLET, TRANSFER, ADD_ORDER, CANCEL_ORDER, TRANSFER_BATCH } type;
+    unsigned checksum;
+    unsigned long long sequence;
+    long long time;
+    unsigned walletId;
+    unsigned otherWalletId;
+    Order::Type orderType;
+    unsigned nameLength;
+    double amount;
+    double price;
+};
+
+struct Journal {
+    FILE* file;
+    unsigned long long sequence;
+    unsigned long long syncedSequence;
+    size_t pendingRecords;
+    long long firstPendingTime;
+    size_t groupCommitCount;
+    long long groupCommitWindow;
+    bool flushEachRecord;
+    // Set when callers acknowledge only after waiting for the commit themselves or after a final sync
+    bool deferCommit;
+    bool failed;
+    bool stopping;
+    std::mutex mutex;
+    std::mutex syncMutex;
+    std::condition_variable pending;
+    std::condition_variable synced;
+    std::thread flusher;
+};
+
+struct ReportOptions {
+    enum Format { CSV, JSON } format;
+    const char* filename;
+    bool filterWallet;
+    unsigned walletId;
+    long long from, to;
+};
+
+struct ReportWriter {
+    FILE* file;
+    char* buffer;
+    size_t size;
+    ReportOptions::Format format;
+    bool failed;
+};
+
+struct IdAllocator {
+    enum Strategy { RANDOM, COUNTER } strategy;
+    unsigned long long state;
+    unsigned long long counter;
+    unsigned key;
+};
+
+struct StartupOptions {
+    size_t threads;
+    bool validateLedger;
+    size_t groupCommitCount;
+    long long groupCommitWindow;
+    long long checkpointInterval;
+    int listenPort;
+    const char* socketPath;
+    const char* batchFilename;
+    const char* statsFilename;
+    IdAllocator::Strategy idStrategy;
+    bool seeded;
+    unsigned long long idSeed;
+};
+
+enum BatchCommandType {
+    ADD_WALLET_COMMAND, MAKE_ORDER_COMMAND, TRANSFER_COMMAND, WALLET_INFO_COMMAND, WALLET_HISTORY_COMMAND,
+    GENERATE_REPORT_COMMAND, ATTRACT_INVESTORS_COMMAND, CHECK_BALANCES_COMMAND, AUDIT_WALLETS_COMMAND,
+    CHECKPOINT_COMMAND, QUIT_COMMAND, CANCEL_ORDER_COMMAND, ADD_WALLETS_COMMAND, STATS_COMMAND,
+    COMPACT_COMMAND, TRANSFER_BATCH_COMMAND, MARKET_STATS_COMMAND, WALLET_STATS_COMMAND, BATCH_COMMAND_COUNT
+};
+
+const char* const BATCH_COMMAND_NAMES[BATCH_COMMAND_COUNT] = {
+    "add-wallet", "make-order", "transfer", "wallet-info", "wallet-history", "generate-report",
+    "attract-investors", "check-balances", "audit-wallets", "checkpoint", "quit", "cancel-order", "add-wallets", "stats",
+    "compact", "transfer-batch", "market-stats", "wallet-stats"
+};
+
+struct CommandTable {
+    int slots[BATCH_COMMAND_TABLE_SIZE];
+    size_t lengths[BATCH_COMMAND_COUNT];
+};
+
+struct BatchStats {
+    size_t counts[BATCH_COMMAND_COUNT];
+    long long times[BATCH_COMMAND_COUNT];
+    long long maxTimes[BATCH_COMMAND_COUNT];
+    size_t unknownCommands;
+};
+
+struct LedgerReplayChunk {
+    size_t first, last;
+    double* net;
+    double* minimum;
+    size_t invalidTransactions;
+};
+
+struct MarketBar {
+    long long start;
+    double open, high, low, close;
+    double volume, notional;
+    size_t trades;
+};
+
+struct BarSeries {
+    long long interval;
+    MarketBar* bars;
+    size_t newest, count;
+    double windowVolume, windowNotional;
+    size_t windowTrades;
+};
+
+struct MarketData {
+    BarSeries series[MARKET_INTERVAL_COUNT];
+};
+
+struct Leaderboard {
+    size_t positions[RICHEST_USERS_COUNT];
+    size_t count;
+    double outsideCoins;
+    bool valid;
+};
+
+struct Checkpoint {
+    std::thread writer;
+    std::atomic<bool> finished;
+    bool active;
+    bool successful;
+    unsigned long long sequence;
+    long long lastTime;
+    long long interval;
+    Wallet* wallets;
+    size_t* executedOrders;
+    double* coins;
+    size_t walletCount;
+    char* owners;
+    size_t ownersSize;
+    Order* orders;
+    bool* executed;
+    long long* orderTimes;
+    size_t orderCount;
+    unsigned long long nextOrderId;
+    Fill* fills;
+    size_t fillCount;
+    size_t persistedFills;
+    Transaction* unsaved;
+    size_t unsavedCount;
+    size_t ledgerSize;
+    size_t persistedCount;
+    unsigned long long checksum;
+};
+
 struct System {
+    IdAllocator ids;
     WalletContainer wallets;
     TransactionContainer transactions;
     OrdersContainer orders;
+    OrderBook bids, asks;
+    FillContainer fills;
+    Journal journal;
+    Checkpoint checkpoint;
+    Leaderboard leaderboard;
+    MarketData market;
 };
 
-void resizeWalletContainer(System& system) {
-    Wallet* newWallets = new (std::nothrow) Wallet[system.wallets.capacity *= 2];
-    size_t* newExecutedOrders = new (std::nothrow) size_t[system.wallets.capacity];
-    for (size_t i = 0; i < system.wallets.count; i++) {
-        newWallets[i] = system.wallets.items[i];
-        newExecutedOrders[i] = system.wallets.executedOrders[i];
+#ifdef EXCHANGE_STATS
+struct LatencyHistogram {
+    std::atomic<unsigned long long> counts[HISTOGRAM_BUCKETS];
+    std::atomic<unsigned long long> total, max;
+};
+
+struct Stats {
+    enum Operation { TRANSFER, ADD_ORDER, EXECUTE_ORDERS, WALLET_INFO, LOAD_SYSTEM, QUIT, OPERATION_COUNT };
+    enum Counter {
+        ORDERS_MATCHED, TRANSACTIONS_APPENDED, WALLET_RESIZES, WALLETS_COPIED, NAME_ARENA_RESIZES, NAME_BYTES_COPIED,
+        CHUNKS_ALLOCATED, CHUNK_DIRECTORY_COPIES, FILL_RESIZES, PRICE_LEVEL_RESIZES, COUNTER_COUNT
+    };
+    LatencyHistogram latencies[OPERATION_COUNT];
+    std::atomic<unsigned long long> counters[COUNTER_COUNT];
+};
+
+const char* const STATS_OPERATION_NAMES[Stats::OPERATION_COUNT] = {
+    "transfer", "addOrder", "executeOrders", "walletInfo", "loadSystem", "quit"
+};
+
+const char* const STATS_COUNTER_NAMES[Stats::COUNTER_COUNT] = {
+    "ordersMatched", "transactionsAppended", "walletResizes", "walletsCopied", "nameArenaResizes", "nameBytesCopied",
+    "chunksAllocated", "chunkDirectoryCopies", "fillResizes", "priceLevelResizes"
+};
+
+Stats statistics;
+
+size_t histogramBucket(const unsigned long long value) {
+    if (value < (1ull << HISTOGRAM_SUB_BUCKET_BITS)) {
+        return (size_t)value;
     }
-    delete[] system.wallets.items;
-    delete[] system.wallets.executedOrders;
-    system.wallets.items = newWallets;
-    system.wallets.executedOrders = newExecutedOrders;
+#ifdef _MSC_VER
+    unsigned long exponent;
+    _BitScanReverse64(&exponent, value);
+#else
+    int exponent = 63 - __builtin_clzll(value);
+#endif
+    size_t subBucket = (size_t)(value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1);
+    return ((exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS) + subBucket;
 }
 
-void resizeTransactionContainer(System& system) {
-    Transaction* newTransactions = new (std::nothrow) Transaction[system.transactions.capacity *= 2];
-    for (size_t i = 0; i < system.transactions.count; i++) {
-        newTransactions[i] = system.transactions.items[i];
+unsigned long long histogramBucketLimit(const size_t bucket) {
+    if (bucket < (1u << HISTOGRAM_SUB_BUCKET_BITS)) {
+        return bucket;
     }
-    delete[] system.transactions.items;
-    system.transactions.items = newTransactions;
+    int shift = (int)(bucket >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+    unsigned long long subBucket = bucket & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1);
+    return (((1ull << HISTOGRAM_SUB_BUCKET_BITS) + subBucket + 1) << shift) - 1;
 }
 
-void resizeOrderContainer(System& system) {
-    Order* newOrders = new (std::nothrow) Order[system.orders.capacity *= 2];
-    bool* newExecuted = new (std::nothrow) bool[system.orders.capacity];
-    for (size_t i = 0; i < system.orders.count; i++) {
-        newOrders[i] = system.orders.items[i];
-        newExecuted[i] = system.orders.executed[i];
+void recordLatency(LatencyHistogram& histogram, const unsigned long long nanoseconds) {
+    histogram.counts[histogramBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    histogram.total.fetch_add(1, std::memory_order_relaxed);
+    unsigned long long max = histogram.max.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !histogram.max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
     }
-    delete[] system.orders.items;
-    delete[] system.orders.executed;
-    system.orders.items = newOrders;
-    system.orders.executed = newExecuted;
 }
 
-unsigned generateId() {
-    unsigned number = 0;
-    for (size_t i = 0; i < 32; i++) {
-        int randomBit = rand() % 2;
-        number = number | (randomBit << i);
+unsigned long long latencyPercentile(const LatencyHistogram& histogram, const double percentile) {
+    unsigned long long total = histogram.total.load(std::memory_order_relaxed);
+    unsigned long long target = (unsigned long long)(total * percentile / 100.0 + 0.5);
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram.counts[i].load(std::memory_order_relaxed);
+        if (seen >= target && seen > 0) {
+            unsigned long long limit = histogramBucketLimit(i);
+            unsigned long long max = histogram.max.load(std::memory_order_relaxed);
+            return limit < max ? limit : max;
+        }
     }
-    return number;
+    return 0;
 }
 
-long long getTime() {
-    long long seconds = time(NULL);
-    return seconds;
-}
+struct LatencyTimer {
+    Stats::Operation operation;
+    std::chrono::steady_clock::time_point start;
 
-Wallet* findWallet(const System& system, const unsigned walletId) {
-    for (size_t i = 0; i < system.wallets.count; i++) {
-        if (system.wallets.items[i].id == walletId) {
-            return &system.wallets.items[i];
-        }
+    LatencyTimer(const Stats::Operation operation) : operation(operation), start(std::chrono::steady_clock::now()) {
     }
-    return nullptr;
+    ~LatencyTimer() {
+        recordLatency(statistics.latencies[operation], std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+#define MEASURE_LATENCY(operation) LatencyTimer latencyTimer(Stats::operation)
+#define COUNT_EVENT(counter, amount) statistics.counters[Stats::counter].fetch_add(amount, std::memory_order_relaxed)
+#else
+#define MEASURE_LATENCY(operation)
+#define COUNT_EVENT(counter, amount)
+#endif
+
+// The low bits of a plain product depend only on the low bits of the ID, so the high bits are mixed down before masking
+size_t hashWalletId(const unsigned walletId, const size_t indexCapacity) {
+    unsigned hash = walletId;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return (size_t)(hash & (indexCapacity - 1));
 }
 
-double getCoins(const System& system, const unsigned walletId) {
-    double balance = 0;
-    for (size_t i = 0; i < system.transactions.count; i++) {
-        if (system.transactions.items[i].senderId == walletId) {
-            balance -= system.transactions.items[i].grnCoins;
-        }
-        else if (system.transactions.items[i].receiverId == walletId) {
-            balance += system.transactions.items[i].grnCoins;
-        }
+void insertWalletIndex(WalletContainer& wallets, const size_t position) {
+    size_t slot = hashWalletId(wallets.items[position].id, wallets.indexCapacity);
+    while (wallets.index[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & (wallets.indexCapacity - 1);
     }
-    return balance;
+    wallets.index[slot] = position + 1;
 }
 
-bool transfer(System& system, const unsigned senderId, const unsigned receiverId, const double grnCoins) {
-    if ((findWallet(system, senderId) == nullptr && senderId != SYSTEM_WALLET_ID) ||
-        findWallet(system, receiverId) == nullptr ||
-        (getCoins(system, senderId) < grnCoins && senderId != SYSTEM_WALLET_ID)) {
-        return false;
+size_t walletIndexCapacity(const size_t capacity) {
+    size_t indexCapacity = 8;
+    while (indexCapacity < capacity * 2) {
+        indexCapacity *= 2;
     }
+    return indexCapacity;
+}
 
-    Transaction transaction;
-    transaction.senderId = senderId;
-    transaction.receiverId = receiverId;
-    transaction.grnCoins = grnCoins;
-    transaction.time = getTime();
-
-    if (system.transactions.count == system.transactions.capacity) {
-        resizeTransactionContainer(system);
+void fillWalletIndex(WalletContainer& wallets, size_t* index, const size_t indexCapacity) {
+    delete[] wallets.index;
+    wallets.index = index;
+    wallets.indexCapacity = indexCapacity;
+    for (size_t i = 0; i < indexCapacity; i++) {
+        wallets.index[i] = EMPTY_SLOT;
     }
-    system.transactions.items[system.transactions.count++] = transaction;
+    for (size_t i = 0; i < wallets.count; i++) {
+        insertWalletIndex(wallets, i);
+    }
+}
 
+bool rebuildWalletIndex(WalletContainer& wallets) {
+    size_t indexCapacity = walletIndexCapacity(wallets.capacity);
+    size_t* index = new (std::nothrow) size_t[indexCapacity];
+    if (index == nullptr) {
+        return false;
+    }
+    fillWalletIndex(wallets, index, indexCapacity);
     return true;
 }
 
-long long addWallet(System& system, const double fiatMoney, const char name[]) {
-    if (strlen(name) <= 255) {
-        Wallet wallet;
-        strcpy(wallet.owner, name);
-        do {
-            wallet.id = generateId();
-        } 
-        while (findWallet(system, wallet.id));
-        wallet.fiatMoney = fiatMoney;
-
-        if (system.wallets.count == system.wallets.capacity) {
-            resizeWalletContainer(system);
-        }
-        system.wallets.items[system.wallets.count++] = wallet;
+size_t hashName(const char name[], const size_t indexCapacity) {
+    size_t hash = 2166136261u;
+    for (const char* character = name; *character != '\0'; character++) {
+        hash = (hash ^ (unsigned char)*character) * 16777619u;
+    }
+    return hash & (indexCapacity - 1);
+}
 
-        if (transfer(system, SYSTEM_WALLET_ID, wallet.id, wallet.fiatMoney / EXCHANGE_RATE)) {
-            return wallet.id;
-        }
+void insertNameIndex(NameArena& arena, const size_t offset) {
+    size_t slot = hashName(arena.items + offset, arena.indexCapacity);
+    while (arena.index[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & (arena.indexCapacity - 1);
     }
-    return -1;
+    arena.index[slot] = offset + 1;
 }
 
-void walletInfo(const System& system, const unsigned walletId) {
-    Wallet* wallet = findWallet(system, walletId);
-    if (wallet != nullptr) {
-        std::cout << "Owner: " << wallet->owner << std::endl;
-        std::cout << "Fiat money: " << wallet->fiatMoney << std::endl;
-        std::cout << "GRN coins: " << getCoins(system, walletId) << std::endl;
+bool rebuildNameIndex(NameArena& arena) {
+    size_t indexCapacity = 8;
+    while (indexCapacity < arena.names * 2) {
+        indexCapacity *= 2;
     }
-    else {
-        std::cout << "There is no wallet with ID: " << walletId << std::endl;
+    size_t* index = new (std::nothrow) size_t[indexCapacity];
+    if (index == nullptr) {
+        return false;
+    }
+    delete[] arena.index;
+    arena.index = index;
+    arena.indexCapacity = indexCapacity;
+    for (size_t i = 0; i < indexCapacity; i++) {
+        arena.index[i] = EMPTY_SLOT;
+    }
+    for (size_t offset = 0; offset < arena.count; offset += strlen(arena.items + offset) + 1) {
+        insertNameIndex(arena, offset);
     }
+    return true;
 }
 
-size_t executedOrders(const System& system, const unsigned walletId) {
-    for (size_t i = 0; i < system.wallets.count; i++) {
-        if (system.wallets.items[i].id == walletId) {
-            return system.wallets.executedOrders[i];
+long long internName(NameArena& arena, const char name[]) {
+    size_t slot = hashName(name, arena.indexCapacity);
+    while (arena.index[slot] != EMPTY_SLOT) {
+        if (strcmp(arena.items + arena.index[slot] - 1, name) == 0) {
+            return (long long)(arena.index[slot] - 1);
         }
+        slot = (slot + 1) & (arena.indexCapacity - 1);
     }
-    return 0;
-}
 
-long long getTimeFirstOrder(const System& system, const unsigned walletId) {
-    for (size_t i = 0; i < system.transactions.count; i++) {
-        if (system.transactions.items[i].receiverId == walletId ||
-            system.transactions.items[i].senderId == walletId) {
-            return system.transactions.items[i].time;
+    size_t length = strlen(name) + 1;
+    if (arena.count + length > arena.capacity) {
+        size_t capacity = arena.capacity;
+        while (arena.count + length > capacity) {
+            capacity *= 2;
+        }
+        char* newItems = new (std::nothrow) char[capacity];
+        if (newItems == nullptr) {
+            return -1;
         }
+        COUNT_EVENT(NAME_ARENA_RESIZES, 1);
+        COUNT_EVENT(NAME_BYTES_COPIED, arena.count);
+        memcpy(newItems, arena.items, arena.count);
+        delete[] arena.items;
+        arena.items = newItems;
+        arena.capacity = capacity;
     }
-    return -1;
-}
+    size_t offset = arena.count;
+    memcpy(arena.items + offset, name, length);
+    arena.count += length;
 
-long long getTimeLastOrder(const System& system, const unsigned walletId) {
-    for (size_t i = system.transactions.count - 1; i >= 0; i--) {
-        if (system.transactions.items[i].receiverId == walletId ||
-            system.transactions.items[i].senderId == walletId) {
-            return system.transactions.items[i].time;
-        }
+    // The old index is at most half full, so it can still take the name if the larger one cannot be allocated
+    if (++arena.names * 2 <= arena.indexCapacity || !rebuildNameIndex(arena)) {
+        arena.index[slot] = offset + 1;
     }
-    return -1;
+    return (long long)offset;
 }
 
-void richUserInfo(const System& system, const unsigned walletId) {
-    Wallet* wallet = findWallet(system, walletId);
-    if (wallet != nullptr) {
-        std::cout << "Owner: " << wallet->owner << std::endl;
-        std::cout << "Wallet ID: " << wallet->id << std::endl;
-        std::cout << "GRN coins: " << getCoins(system, walletId) << std::endl;
-        size_t executedOrdersCount = executedOrders(system, walletId);
-        std::cout << "Executed orders: " << executedOrdersCount << std::endl;
-        if (executedOrdersCount!=0) {
-            std::cout << "First order executed at: " << getTimeFirstOrder(system, walletId) << std::endl;
-            std::cout << "Last order executed at: " << getTimeLastOrder(system, walletId) << std::endl;
-        }
+const char* getOwner(const WalletContainer& wallets, const Wallet& wallet) {
+    return wallets.owners.items + wallet.ownerOffset;
+}
+
+bool resizeWalletContainer(System& system, const size_t capacity) {
+    size_t indexCapacity = walletIndexCapacity(capacity);
+    Wallet* newWallets = new (std::nothrow) Wallet[capacity];
+    size_t* newExecutedOrders = new (std::nothrow) size_t[capacity];
+    double* newCoins = new (std::nothrow) double[capacity];
+    double* newReservedFiat = new (std::nothrow) double[capacity];
+    double* newReservedCoins = new (std::nothrow) double[capacity];
+    WalletHistory* newHistories = new (std::nothrow) WalletHistory[capacity];
+    WalletVolume* newVolumes = new (std::nothrow) WalletVolume[capacity];
+    size_t* newIndex = new (std::nothrow) size_t[indexCapacity];
+    if (newWallets == nullptr || newExecutedOrders == nullptr || newCoins == nullptr || newReservedFiat == nullptr ||
+        newReservedCoins == nullptr || newHistories == nullptr || newVolumes == nullptr || newIndex == nullptr) {
+        delete[] newWallets;
+        delete[] newExecutedOrders;
+        delete[] newCoins;
+        delete[] newReservedFiat;
+        delete[] newReservedCoins;
+        delete[] newHistories;
+        delete[] newVolumes;
+        delete[] newIndex;
+        return false;
     }
-    else {
-        std::cout << "There is no wallet with ID: " << walletId << std::endl;
+
+    COUNT_EVENT(WALLET_RESIZES, 1);
+    COUNT_EVENT(WALLETS_COPIED, system.wallets.count);
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        newWallets[i] = system.wallets.items[i];
+        newExecutedOrders[i] = system.wallets.executedOrders[i];
+        newCoins[i] = system.wallets.coins[i];
+        newReservedFiat[i] = system.wallets.reservedFiat[i];
+        newReservedCoins[i] = system.wallets.reservedCoins[i];
+        newHistories[i] = system.wallets.histories[i];
+        newVolumes[i] = system.wallets.volumes[i];
     }
+    delete[] system.wallets.items;
+    delete[] system.wallets.executedOrders;
+    delete[] system.wallets.coins;
+    delete[] system.wallets.reservedFiat;
+    delete[] system.wallets.reservedCoins;
+    delete[] system.wallets.histories;
+    delete[] system.wallets.volumes;
+    system.wallets.items = newWallets;
+    system.wallets.executedOrders = newExecutedOrders;
+    system.wallets.coins = newCoins;
+    system.wallets.reservedFiat = newReservedFiat;
+    system.wallets.reservedCoins = newReservedCoins;
+    system.wallets.histories = newHistories;
+    system.wallets.volumes = newVolumes;
+    system.wallets.capacity = capacity;
+    fillWalletIndex(system.wallets, newIndex, indexCapacity);
+    return true;
 }
 
-void swap(Wallet* wallet1, Wallet* wallet2) {
-    Wallet swap = *wallet1;
-    *wallet1 = *wallet2;
-    *wallet2 = swap;
+template <typename T>
+ChunkPool& chunkPool() {
+    static ChunkPool pool = { CHUNK_SIZE * sizeof(T), nullptr, nullptr, SLAB_CHUNKS };
+    return pool;
 }
 
-void attractInvestors(const System& system) {
-    for (size_t i = 0; i < RICHEST_USERS_COUNT; i++) {
-        unsigned maxCoinsWalletId = system.wallets.items[i].id;
-        for (size_t j = i + 1; j < system.wallets.count; j++) {
-            if (getCoins(system, maxCoinsWalletId) < getCoins(system, system.wallets.items[j].id)) {
-                maxCoinsWalletId = system.wallets.items[j].id;
-            }
+void* allocateChunk(ChunkPool& pool) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.freeChunks != nullptr) {
+        void* chunk = pool.freeChunks;
+        pool.freeChunks = *(void**)chunk;
+        return chunk;
+    }
+    if (pool.slabUsed == SLAB_CHUNKS) {
+        pool.slab = new (std::nothrow) char[pool.chunkBytes * SLAB_CHUNKS];
+        if (pool.slab == nullptr) {
+            return nullptr;
         }
-        swap(findWallet(system, maxCoinsWalletId),
-            findWallet(system, system.wallets.items[i].id));
-        richUserInfo(system, maxCoinsWalletId);
+        pool.slabUsed = 0;
     }
+    return pool.slab + pool.chunkBytes * pool.slabUsed++;
 }
 
-void generateTextFile(const System& system) {
+void releaseChunk(ChunkPool& pool, void* chunk) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    *(void**)chunk = pool.freeChunks;
+    pool.freeChunks = chunk;
+}
 
+template <typename T>
+void initChunkedArray(ChunkedArray<T>& array) {
+    array.chunks = nullptr;
+    array.chunkCount = 0;
+    array.directoryCapacity = 0;
 }
 
-void executeOrders(System& system) {
-    for (size_t i = 0; i < system.orders.count; i++) {
-        if (system.orders.items[i].type == Order::Type::BUY && !(system.orders.executed[i])) {
-            for (size_t j = i + 1; j < system.orders.count; j++) {
-                if (system.orders.items[j].type == Order::Type::SELL && !(system.orders.executed[j])) {
-                    double buyCoins = system.orders.items[i].grnCoins;
-                    double sellCoins = system.orders.items[j].grnCoins;
-                    if (buyCoins >= sellCoins) {
-                        transfer(system, system.orders.items[j].walletId, system.orders.items[i].walletId,
-                            sellCoins);
-                        findWallet(system, system.orders.items[i].walletId)->fiatMoney -= sellCoins * EXCHANGE_RATE;
-                        findWallet(system, system.orders.items[j].walletId)->fiatMoney += sellCoins * EXCHANGE_RATE;
-                        system.orders.executed[j] = true;
-                        
-                    }
-                    else {
-                        transfer(system, system.orders.items[j].walletId, system.orders.items[i].walletId,
-                            buyCoins);
-                        findWallet(system, system.orders.items[i].walletId)->fiatMoney -= buyCoins * EXCHANGE_RATE;
-                        findWallet(system, system.orders.items[j].walletId)->fiatMoney += buyCoins * EXCHANGE_RATE;
-                        system.orders.executed[i] = true;
-                    }
-                }
-            }
+template <typename T>
+bool growChunkedArray(ChunkedArray<T>& array) {
+    if (array.chunkCount == array.directoryCapacity) {
+        COUNT_EVENT(CHUNK_DIRECTORY_COPIES, 1);
+        size_t capacity = array.directoryCapacity * 2 + INITIAL_CAPACITY;
+        T** chunks = new (std::nothrow) T*[capacity];
+        if (chunks == nullptr) {
+            return false;
         }
-        else if (system.orders.items[i].type == Order::Type::SELL && !(system.orders.executed[i])) {
-            for (size_t j = i + 1; j < system.orders.count; j++) {
-                if (system.orders.items[j].type == Order::Type::BUY && !(system.orders.executed[j])) {
-                    double sellCoins = system.orders.items[i].grnCoins;
-                    double buyCoins = system.orders.items[j].grnCoins;
-                    if (buyCoins >= sellCoins) {
-                        transfer(system, system.orders.items[i].walletId, system.orders.items[j].walletId,
-                            sellCoins);
-                        findWallet(system, system.orders.items[i].walletId)->fiatMoney += sellCoins * EXCHANGE_RATE;
-                        findWallet(system, system.orders.items[j].walletId)->fiatMoney -= sellCoins * EXCHANGE_RATE;
-                        system.orders.executed[i] = true;
-
-                    }
-                    else {
-                        transfer(system, system.orders.items[i].walletId, system.orders.items[j].walletId,
-                            buyCoins);
-                        findWallet(system, system.orders.items[i].walletId)->fiatMoney += buyCoins * EXCHANGE_RATE;
-                        findWallet(system, system.orders.items[j].walletId)->fiatMoney -= buyCoins * EXCHANGE_RATE;
-                        system.orders.executed[j] = true;
-                    }
-                }
-            }
+        for (size_t i = 0; i < array.chunkCount; i++) {
+            chunks[i] = array.chunks[i];
         }
+        delete[] array.chunks;
+        array.chunks = chunks;
+        array.directoryCapacity = capacity;
+    }
+    T* chunk = (T*)allocateChunk(chunkPool<T>());
+    if (chunk == nullptr) {
+        return false;
     }
+    array.chunks[array.chunkCount++] = chunk;
+    COUNT_EVENT(CHUNKS_ALLOCATED, 1);
+    return true;
 }
 
-double buyerUsableMoney(const System& system, const unsigned walletId) {
-    double usableMoney = findWallet(system, walletId)->fiatMoney;
-    for (size_t i = 0; i < system.orders.count; i++) {
-        if (system.orders.items[i].walletId = walletId &&
-            system.orders.items[i].type == Order::Type::BUY &&
-            !(system.orders.executed[i])) {
-            usableMoney -= system.orders.items[i].grnCoins * EXCHANGE_RATE;
+template <typename T>
+bool reserveChunkedArray(ChunkedArray<T>& array, const size_t count) {
+    while (array.chunkCount * CHUNK_SIZE < count) {
+        if (!growChunkedArray(array)) {
+            return false;
         }
     }
-    return usableMoney;
+    return true;
+}
+
+template <typename T>
+void releaseChunkedArray(ChunkedArray<T>& array) {
+    for (size_t i = 0; i < array.chunkCount; i++) {
+        releaseChunk(chunkPool<T>(), array.chunks[i]);
+    }
+    delete[] array.chunks;
+    initChunkedArray(array);
 }
 
-double sellerUsableCoins(const System& system, const unsigned walletId) {
-    double usableCoins = getCoins(system, walletId);
-    for (size_t i = 0; i < system.orders.count; i++) {
-        if (system.orders.items[i].walletId = walletId &&
-            system.orders.items[i].type == Order::Type::SELL &&
-            !(system.orders.executed[i])) {
-            usableCoins -= system.orders.items[i].grnCoins;
-        }
+template <typename T>
+void truncateChunkedArray(ChunkedArray<T>& array, const size_t count) {
+    while (array.chunkCount > (count + CHUNK_SIZE - 1) / CHUNK_SIZE) {
+        releaseChunk(chunkPool<T>(), array.chunks[--array.chunkCount]);
     }
-    return usableCoins;
 }
 
-bool addOrder(System& system, const unsigned walletId, const Order::Type type, const double grnCoins) {
-    if (findWallet(system, walletId) == nullptr) {
+bool resizeTransactionContainer(TransactionContainer& transactions) {
+    size_t capacity = transactions.capacity + CHUNK_SIZE;
+    if (!reserveChunkedArray(transactions.times, capacity) || !reserveChunkedArray(transactions.senderIds, capacity) ||
+        !reserveChunkedArray(transactions.receiverIds, capacity) || !reserveChunkedArray(transactions.grnCoins, capacity)) {
         return false;
     }
+    transactions.capacity = capacity;
+    return true;
+}
 
-    if (type == Order::Type::BUY) {
-        if (buyerUsableMoney(system,walletId) < grnCoins * EXCHANGE_RATE) {
-            return false;
-        }
+size_t ledgerSize(const TransactionContainer& transactions) {
+    return transactions.historyCount + transactions.count;
+}
 
-        Order order;
-        order.type = Order::Type::BUY;
-        order.walletId = walletId;
-        order.grnCoins = grnCoins;
+LedgerColumns getLedgerBlock(const char* blocks, const size_t block, const size_t count) {
+    const char* base = blocks + block * LEDGER_BLOCK_SIZE * sizeof(Transaction);
+    LedgerColumns columns;
+    columns.times = (const long long*)base;
+    columns.senderIds = (const unsigned*)(base + LEDGER_BLOCK_SIZE * sizeof(long long));
+    columns.receiverIds = (const unsigned*)(base + LEDGER_BLOCK_SIZE * (sizeof(long long) + sizeof(unsigned)));
+    columns.grnCoins = (const double*)(base + LEDGER_BLOCK_SIZE * (sizeof(long long) + 2 * sizeof(unsigned)));
+    columns.count = count;
+    return columns;
+}
 
-        if (system.orders.count == system.orders.capacity) {
-            resizeOrderContainer(system);
-        }
-        system.orders.items[system.orders.count] = order;
-        system.orders.executed[system.orders.count++] = false;
+size_t ledgerSegmentCount(const TransactionContainer& transactions) {
+    return (transactions.historyCount + LEDGER_BLOCK_SIZE - 1) / LEDGER_BLOCK_SIZE +
+        (transactions.count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
 
-        executeOrders(system);
+LedgerColumns getLedgerSegment(const TransactionContainer& transactions, const size_t segment) {
+    size_t historyBlocks = (transactions.historyCount + LEDGER_BLOCK_SIZE - 1) / LEDGER_BLOCK_SIZE;
+    if (segment < historyBlocks) {
+        size_t first = segment * LEDGER_BLOCK_SIZE;
+        size_t remaining = transactions.historyCount - first;
+        return getLedgerBlock(transactions.history, segment, remaining < LEDGER_BLOCK_SIZE ? remaining : LEDGER_BLOCK_SIZE);
     }
-    else if (type == Order::Type::SELL) {
-        if (sellerUsableCoins(system, walletId) < grnCoins) {
-            return false;
-        }
+    size_t chunk = segment - historyBlocks;
+    size_t remaining = transactions.count - chunk * CHUNK_SIZE;
+    LedgerColumns columns;
+    columns.times = transactions.times.chunks[chunk];
+    columns.senderIds = transactions.senderIds.chunks[chunk];
+    columns.receiverIds = transactions.receiverIds.chunks[chunk];
+    columns.grnCoins = transactions.grnCoins.chunks[chunk];
+    columns.count = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+    return columns;
+}
 
-        Order order;
-        order.type = Order::Type::SELL;
-        order.walletId = walletId;
-        order.grnCoins = grnCoins;
-        if (system.orders.count == system.orders.capacity) {
-            resizeOrderContainer(system);
-        }
-        system.orders.items[system.orders.count] = order;
-        system.orders.executed[system.orders.count++] = false; 
+Transaction getTransaction(const TransactionContainer& transactions, const size_t position) {
+    Transaction transaction;
+    if (position < transactions.historyCount) {
+        LedgerColumns columns = getLedgerBlock(transactions.history, position / LEDGER_BLOCK_SIZE, LEDGER_BLOCK_SIZE);
+        size_t offset = position % LEDGER_BLOCK_SIZE;
+        transaction.time = columns.times[offset];
+        transaction.senderId = columns.senderIds[offset];
+        transaction.receiverId = columns.receiverIds[offset];
+        transaction.grnCoins = columns.grnCoins[offset];
+        return transaction;
+    }
+    size_t offset = position - transactions.historyCount;
+    transaction.time = transactions.times[offset];
+    transaction.senderId = transactions.senderIds[offset];
+    transaction.receiverId = transactions.receiverIds[offset];
+    transaction.grnCoins = transactions.grnCoins[offset];
+    return transaction;
+}
 
-        executeOrders(system);
+unsigned long long bytesChecksum(unsigned long long checksum, const void* data, const size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        checksum = (checksum ^ bytes[i]) * 1099511628211ull;
     }
+    return checksum;
+}
 
-    return true;
+unsigned long long ledgerChecksum(unsigned long long checksum, const Transaction* transactions, const size_t count) {
+    return bytesChecksum(checksum, transactions, count * sizeof(Transaction));
 }
 
-size_t getFileSize(std::ifstream& file) {
-    size_t currentPosition = file.tellg();
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    file.seekg(currentPosition);
-    return size;
+double netFlowScalar(const LedgerColumns& columns, const unsigned walletId) {
+    double inflow = 0, outflow = 0;
+    for (size_t i = 0; i < columns.count; i++) {
+        inflow += columns.receiverIds[i] == walletId ? columns.grnCoins[i] : 0;
+        outflow += columns.senderIds[i] == walletId ? columns.grnCoins[i] : 0;
+    }
+    return inflow - outflow;
 }
 
-bool quit(const System& system) {
-    bool successfullySaved = true;
+#ifdef LEDGER_AVX2_KERNELS
+bool cpuSupportsAvx2() {
+#ifdef _MSC_VER
+    int registers[4];
+    __cpuid(registers, 1);
+    bool osSavesAvx = (registers[2] & (1 << 27)) != 0 && (registers[2] & (1 << 28)) != 0 &&
+        (_xgetbv(0) & 6) == 6;
+    __cpuidex(registers, 7, 0);
+    return osSavesAvx && (registers[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
 
-    std::ofstream walletsFile(WALLETS_FILENAME, std::ios::binary);
-    if(walletsFile.is_open()) {
-        walletsFile.write((const char*)&system.wallets.items, system.wallets.count * sizeof(Wallet));
-        walletsFile.close();
+AVX2_TARGET double netFlowAvx2(const LedgerColumns& columns, const unsigned walletId) {
+    __m128i id = _mm_set1_epi32((int)walletId);
+    __m256d inflow = _mm256_setzero_pd();
+    __m256d outflow = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= columns.count; i += 4) {
+        __m256d grnCoins = _mm256_loadu_pd(columns.grnCoins + i);
+        __m128i senders = _mm_loadu_si128((const __m128i*)(columns.senderIds + i));
+        __m128i receivers = _mm_loadu_si128((const __m128i*)(columns.receiverIds + i));
+        __m256d senderMask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_cmpeq_epi32(senders, id)));
+        __m256d receiverMask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_cmpeq_epi32(receivers, id)));
+        inflow = _mm256_add_pd(inflow, _mm256_and_pd(receiverMask, grnCoins));
+        outflow = _mm256_add_pd(outflow, _mm256_and_pd(senderMask, grnCoins));
     }
-    else {
-        successfullySaved = false;
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_sub_pd(inflow, outflow));
+    LedgerColumns rest = columns;
+    rest.senderIds += i;
+    rest.receiverIds += i;
+    rest.grnCoins += i;
+    rest.count -= i;
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + netFlowScalar(rest, walletId);
+}
+#endif
+
+double netFlow(const LedgerColumns& columns, const unsigned walletId) {
+#ifdef LEDGER_AVX2_KERNELS
+    static const bool avx2 = cpuSupportsAvx2();
+    if (avx2) {
+        return netFlowAvx2(columns, walletId);
     }
+#endif
+    return netFlowScalar(columns, walletId);
+}
 
-    std::ofstream executedOrdersFile(EXECUTED_ORDERS_FILENAME, std::ios::binary);
-    if (executedOrdersFile.is_open()) {
-        executedOrdersFile.write((const char*)&system.wallets.executedOrders, system.wallets.count * sizeof(size_t));
-        executedOrdersFile.close();
+double ledgerNetFlow(const TransactionContainer& transactions, const unsigned walletId) {
+    double flow = 0;
+    for (size_t i = 0; i < ledgerSegmentCount(transactions); i++) {
+        flow += netFlow(getLedgerSegment(transactions, i), walletId);
     }
-    else {
-        successfullySaved = false;
+    return flow;
+}
+
+size_t findNetFlowSlot(const size_t* index, const size_t indexCapacity, const unsigned* walletIds,
+    const unsigned walletId) {
+    size_t slot = hashWalletId(walletId, indexCapacity);
+    while (index[slot] != EMPTY_SLOT && walletIds[index[slot] - 1] != walletId) {
+        slot = (slot + 1) & (indexCapacity - 1);
     }
+    return slot;
+}
 
-    std::ofstream transactionsFile(TRANSACTIONS_FILENAME, std::ios::binary);
-    if (transactionsFile.is_open()) {
-        transactionsFile.write((const char*)&system.transactions.items, system.transactions.count * sizeof(Transaction));
-        transactionsFile.close();
+void ledgerNetFlows(const TransactionContainer& transactions, const unsigned* walletIds, double* flows,
+    const size_t count) {
+    for (size_t j = 0; j < count; j++) {
+        flows[j] = 0;
     }
-    else {
-        successfullySaved = false;
+    // The vector kernel scans the ledger once per wallet, so past a few wallets a single scatter pass wins
+    size_t indexCapacity = walletIndexCapacity(count);
+    size_t* index = count > NET_FLOW_KERNEL_WALLETS ? new (std::nothrow) size_t[indexCapacity] : nullptr;
+    if (index == nullptr) {
+        for (size_t i = 0; i < ledgerSegmentCount(transactions); i++) {
+            LedgerColumns columns = getLedgerSegment(transactions, i);
+            for (size_t j = 0; j < count; j++) {
+                flows[j] += netFlow(columns, walletIds[j]);
+            }
+        }
+        return;
     }
 
-    std::ofstream ordersFile(ORDERS_FILENAME, std::ios::binary);
-    if (ordersFile.is_open()) {
-        ordersFile.write((const char*)&system.orders.items, system.orders.count * sizeof(Order));
-        ordersFile.close();
+    for (size_t i = 0; i < indexCapacity; i++) {
+        index[i] = EMPTY_SLOT;
     }
-    else {
-        successfullySaved = false;
+    for (size_t j = 0; j < count; j++) {
+        size_t slot = findNetFlowSlot(index, indexCapacity, walletIds, walletIds[j]);
+        if (index[slot] == EMPTY_SLOT) {
+            index[slot] = j + 1;
+        }
     }
-
-    return successfullySaved;
-}
-
-void loadSystem(System& system) {
+    for (size_t i = 0; i < ledgerSegmentCount(transactions); i++) {
+        LedgerColumns columns = getLedgerSegment(transactions, i);
+        for (size_t k = 0; k < columns.count; k++) {
+            size_t sender = index[findNetFlowSlot(index, indexCapacity, walletIds, columns.senderIds[k])];
+            if (sender != EMPTY_SLOT) {
+                flows[sender - 1] -= columns.grnCoins[k];
+            }
+            size_t receiver = index[findNetFlowSlot(index, indexCapacity, walletIds, columns.receiverIds[k])];
+            if (receiver != EMPTY_SLOT) {
+                flows[receiver - 1] += columns.grnCoins[k];
+            }
+        }
+    }
+    for (size_t j = 0; j < count; j++) {
+        flows[j] = flows[index[findNetFlowSlot(index, indexCapacity, walletIds, walletIds[j])] - 1];
+    }
+    delete[] index;
+}
+
+bool resizeOrderContainer(System& system) {
+    OrdersContainer& orders = system.orders;
+    size_t capacity = orders.capacity + CHUNK_SIZE;
+    if (!reserveChunkedArray(orders.items, capacity) || !reserveChunkedArray(orders.executed, capacity) ||
+        !reserveChunkedArray(orders.times, capacity) || !reserveChunkedArray(orders.next, capacity) ||
+        !reserveChunkedArray(orders.previous, capacity)) {
+        return false;
+    }
+    orders.capacity = capacity;
+    return true;
+}
+
+bool resizeFillContainer(FillContainer& fills) {
+    if (!reserveChunkedArray(fills.items, fills.capacity + CHUNK_SIZE)) {
+        return false;
+    }
+    COUNT_EVENT(FILL_RESIZES, 1);
+    fills.capacity += CHUNK_SIZE;
+    return true;
+}
+
+unsigned long long nextRandom(unsigned long long& state) {
+    unsigned long long value = (state += 0x9e3779b97f4a7c15ull);
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+unsigned scrambleId(unsigned value, const unsigned key) {
+    value ^= key;
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+unsigned generateId(IdAllocator& allocator) {
+    if (allocator.strategy == IdAllocator::Strategy::COUNTER) {
+        return scrambleId((unsigned)allocator.counter++, allocator.key);
+    }
+    return (unsigned)(nextRandom(allocator.state) >> 32);
+}
+
+long long getTime() {
+    long long seconds = time(NULL);
+    return seconds;
+}
+
+long long getMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long getMicroseconds() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long getNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned journalChecksum(const JournalRecord& record, const char name[]) {
+    JournalRecord copy = record;
+    copy.checksum = 0;
+    unsigned checksum = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)&copy;
+    for (size_t i = 0; i < sizeof(JournalRecord); i++) {
+        checksum = (checksum ^ bytes[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < record.nameLength; i++) {
+        checksum = (checksum ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return checksum;
+}
+
+void failJournal(Journal& journal) {
+    if (!journal.failed) {
+        std::cout << "Could not write to " << JOURNAL_FILENAME << ", rejecting further changes" << std::endl;
+    }
+    journal.failed = true;
+    journal.synced.notify_all();
+}
+
+bool syncJournal(Journal& journal) {
+    std::lock_guard<std::mutex> syncLock(journal.syncMutex);
+    std::unique_lock<std::mutex> lock(journal.mutex);
+    if (journal.file == nullptr || journal.pendingRecords == 0) {
+        return !journal.failed;
+    }
+    journal.pendingRecords = 0;
+    unsigned long long sequence = journal.sequence;
+    if (fflush(journal.file) != 0) {
+        failJournal(journal);
+        return false;
+    }
+#ifdef _WIN32
+    int fd = _fileno(journal.file);
+    lock.unlock();
+    bool synced = _commit(fd) == 0;
+#else
+    int fd = fileno(journal.file);
+    lock.unlock();
+    bool synced = fsync(fd) == 0;
+#endif
+    lock.lock();
+    if (synced) {
+        journal.syncedSequence = sequence;
+        journal.synced.notify_all();
+    }
+    else {
+        failJournal(journal);
+    }
+    return synced;
+}
+
+// Waits for the flusher, or a writer that made the group due, to commit the records up to sequence
+bool waitForJournal(Journal& journal, const unsigned long long sequence) {
+    std::unique_lock<std::mutex> lock(journal.mutex);
+    journal.synced.wait(lock, [&journal, sequence] { return journal.syncedSequence >= sequence || journal.failed; });
+    return journal.syncedSequence >= sequence;
+}
+
+unsigned long long journalSequence(Journal& journal) {
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    return journal.sequence;
+}
+
+// A sequential caller has nobody to share the commit with, so it syncs before acknowledging
+bool commitJournal(Journal& journal, const bool syncDue) {
+    return journal.deferCommit ? !syncDue || syncJournal(journal) : syncJournal(journal);
+}
+
+// Called with journal.mutex held; returns whether the pending records are due for a group commit
+bool markJournalPending(Journal& journal, const size_t count) {
+    long long now = getMilliseconds();
+    if (journal.pendingRecords == 0) {
+        journal.firstPendingTime = now;
+        journal.pending.notify_one();
+    }
+    journal.pendingRecords += count;
+    return journal.pendingRecords >= journal.groupCommitCount || now - journal.firstPendingTime >= journal.groupCommitWindow;
+}
+
+bool writeJournalRecord(Journal& journal, JournalRecord& record, const char name[], bool& syncDue) {
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    if (journal.file == nullptr || journal.failed) {
+        return false;
+    }
+    record.sequence = ++journal.sequence;
+    record.checksum = journalChecksum(record, name);
+    if (fwrite(&record, sizeof(JournalRecord), 1, journal.file) != 1 ||
+        fwrite(name, 1, record.nameLength, journal.file) != record.nameLength ||
+        (journal.flushEachRecord && fflush(journal.file) != 0)) {
+        failJournal(journal);
+        return false;
+    }
+
+    syncDue = markJournalPending(journal, 1);
+    return true;
+}
+
+// Written under one lock, so the flusher never syncs part of the group and replay sees it whole or truncated
+bool writeJournalRecords(Journal& journal, JournalRecord records[], const size_t count, bool& syncDue) {
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    if (journal.file == nullptr || journal.failed) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        records[i].sequence = ++journal.sequence;
+        records[i].checksum = journalChecksum(records[i], "");
+    }
+    if (fwrite(records, sizeof(JournalRecord), count, journal.file) != count ||
+        (journal.flushEachRecord && fflush(journal.file) != 0)) {
+        failJournal(journal);
+        return false;
+    }
+    syncDue = markJournalPending(journal, count);
+    return true;
+}
+
+bool appendJournalRecord(Journal& journal, JournalRecord& record, const char name[]) {
+    bool syncDue = false;
+    return writeJournalRecord(journal, record, name, syncDue) && commitJournal(journal, syncDue);
+}
+
+void runJournalFlusher(Journal& journal) {
+#ifdef EXCHANGE_SERVER
+    // The flusher starts before the server blocks its stop signals, so it must not be the thread they land on
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+    std::unique_lock<std::mutex> lock(journal.mutex);
+    while (!journal.stopping) {
+        if (journal.pendingRecords == 0) {
+            journal.pending.wait(lock);
+            continue;
+        }
+        long long wait = journal.firstPendingTime + journal.groupCommitWindow - getMilliseconds();
+        if (wait > 0) {
+            journal.pending.wait_for(lock, std::chrono::milliseconds(wait));
+            continue;
+        }
+        lock.unlock();
+        syncJournal(journal);
+        lock.lock();
+    }
+}
+
+void startJournalFlusher(Journal& journal) {
+    journal.stopping = false;
+    if (journal.groupCommitWindow > 0) {
+        journal.flusher = std::thread(runJournalFlusher, std::ref(journal));
+    }
+}
+
+bool closeJournal(Journal& journal) {
+    if (journal.flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(journal.mutex);
+            journal.stopping = true;
+            journal.pending.notify_one();
+        }
+        journal.flusher.join();
+    }
+    bool synced = syncJournal(journal);
+    if (journal.file != nullptr) {
+        fclose(journal.file);
+        journal.file = nullptr;
+    }
+    return synced;
+}
+
+JournalRecord makeJournalRecord(const JournalRecord::Type type, const long long time) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(JournalRecord));
+    record.type = type;
+    record.time = time;
+    return record;
+}
+
+size_t findWalletSlot(const WalletContainer& wallets, const unsigned walletId) {
+    size_t slot = hashWalletId(walletId, wallets.indexCapacity);
+    while (wallets.index[slot] != EMPTY_SLOT && wallets.items[wallets.index[slot] - 1].id != walletId) {
+        slot = (slot + 1) & (wallets.indexCapacity - 1);
+    }
+    return slot;
+}
+
+long long findWalletPosition(const System& system, const unsigned walletId) {
+    size_t slot = findWalletSlot(system.wallets, walletId);
+    if (system.wallets.index[slot] == EMPTY_SLOT) {
+        return -1;
+    }
+    return system.wallets.index[slot] - 1;
+}
+
+Wallet* findWallet(const System& system, const unsigned walletId) {
+    long long position = findWalletPosition(system, walletId);
+    if (position != -1) {
+        return &system.wallets.items[position];
+    }
+    return nullptr;
+}
+
+double getCoins(const System& system, const unsigned walletId) {
+    long long position = findWalletPosition(system, walletId);
+    if (position != -1) {
+        return system.wallets.coins[position];
+    }
+    return 0;
+}
+
+void applyTransaction(const System& system, double* coins, const Transaction& transaction) {
+    long long senderPosition = findWalletPosition(system, transaction.senderId);
+    if (senderPosition != -1) {
+        coins[senderPosition] -= transaction.grnCoins;
+    }
+    long long receiverPosition = findWalletPosition(system, transaction.receiverId);
+    if (receiverPosition != -1) {
+        coins[receiverPosition] += transaction.grnCoins;
+    }
+}
+
+void accumulateBalances(const System& system, double* coins) {
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        coins[i] = 0;
+    }
+    for (size_t segment = 0; segment < ledgerSegmentCount(system.transactions); segment++) {
+        LedgerColumns columns = getLedgerSegment(system.transactions, segment);
+        for (size_t i = 0; i < columns.count; i++) {
+            long long senderPosition = findWalletPosition(system, columns.senderIds[i]);
+            if (senderPosition != -1) {
+                coins[senderPosition] -= columns.grnCoins[i];
+            }
+            long long receiverPosition = findWalletPosition(system, columns.receiverIds[i]);
+            if (receiverPosition != -1) {
+                coins[receiverPosition] += columns.grnCoins[i];
+            }
+        }
+    }
+}
+
+bool isSameBalance(const double balance, const double otherBalance) {
+    double tolerance = 1e-9 * (balance < 0 ? -balance : balance) + 1e-9;
+    return balance - otherBalance <= tolerance && otherBalance - balance <= tolerance;
+}
+
+void replayLedgerChunk(const System& system, LedgerReplayChunk& chunk) {
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        chunk.net[i] = 0;
+        chunk.minimum[i] = 0;
+    }
+    chunk.invalidTransactions = 0;
+
+    size_t segmentStart = 0;
+    for (size_t segment = 0; segment < ledgerSegmentCount(system.transactions) && segmentStart < chunk.last; segment++) {
+        LedgerColumns columns = getLedgerSegment(system.transactions, segment);
+        size_t begin = chunk.first > segmentStart ? chunk.first - segmentStart : 0;
+        size_t end = chunk.last - segmentStart < columns.count ? chunk.last - segmentStart : columns.count;
+        for (size_t i = begin; i < end; i++) {
+            long long senderPosition = findWalletPosition(system, columns.senderIds[i]);
+            long long receiverPosition = findWalletPosition(system, columns.receiverIds[i]);
+            if ((senderPosition == -1 && columns.senderIds[i] != SYSTEM_WALLET_ID) || receiverPosition == -1) {
+                chunk.invalidTransactions++;
+            }
+            if (senderPosition != -1) {
+                chunk.net[senderPosition] -= columns.grnCoins[i];
+                if (chunk.net[senderPosition] < chunk.minimum[senderPosition]) {
+                    chunk.minimum[senderPosition] = chunk.net[senderPosition];
+                }
+            }
+            if (receiverPosition != -1) {
+                chunk.net[receiverPosition] += columns.grnCoins[i];
+            }
+        }
+        segmentStart += columns.count;
+    }
+}
+
+void mergeLedgerChunks(const LedgerReplayChunk* chunks, const size_t chunkCount, const size_t firstWallet,
+    const size_t lastWallet, double* coins, size_t& negativeWallets) {
+    negativeWallets = 0;
+    for (size_t wallet = firstWallet; wallet < lastWallet; wallet++) {
+        double balance = 0, minimum = 0;
+        for (size_t i = 0; i < chunkCount; i++) {
+            if (balance + chunks[i].minimum[wallet] < minimum) {
+                minimum = balance + chunks[i].minimum[wallet];
+            }
+            balance += chunks[i].net[wallet];
+        }
+        coins[wallet] = balance;
+        if (minimum < 0 && !isSameBalance(minimum, 0)) {
+            negativeWallets++;
+        }
+    }
+}
+
+bool replayLedgerInParallel(System& system, size_t threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    size_t transactionCount = ledgerSize(system.transactions);
+    LedgerReplayChunk* chunks = new (std::nothrow) LedgerReplayChunk[threads];
+    std::thread* workers = new (std::nothrow) std::thread[threads];
+    size_t* negativeWallets = new (std::nothrow) size_t[threads];
+    bool allocated = chunks != nullptr && workers != nullptr && negativeWallets != nullptr;
+    for (size_t i = 0; chunks != nullptr && i < threads; i++) {
+        chunks[i].net = allocated ? new (std::nothrow) double[system.wallets.count > 0 ? system.wallets.count : 1] : nullptr;
+        chunks[i].minimum = allocated ? new (std::nothrow) double[system.wallets.count > 0 ? system.wallets.count : 1] : nullptr;
+        allocated = allocated && chunks[i].net != nullptr && chunks[i].minimum != nullptr;
+    }
+    if (!allocated) {
+        for (size_t i = 0; chunks != nullptr && i < threads; i++) {
+            delete[] chunks[i].net;
+            delete[] chunks[i].minimum;
+        }
+        delete[] negativeWallets;
+        delete[] workers;
+        delete[] chunks;
+        if (threads > 1) {
+            return replayLedgerInParallel(system, 1);
+        }
+        std::cout << "Not enough memory to validate the ledger, balances are replayed without validation" << std::endl;
+        accumulateBalances(system, system.wallets.coins);
+        return false;
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        chunks[i].first = transactionCount * i / threads;
+        chunks[i].last = transactionCount * (i + 1) / threads;
+        workers[i] = std::thread(replayLedgerChunk, std::cref(system), std::ref(chunks[i]));
+    }
+    size_t invalidTransactions = 0;
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].join();
+        invalidTransactions += chunks[i].invalidTransactions;
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        workers[i] = std::thread(mergeLedgerChunks, chunks, threads, system.wallets.count * i / threads,
+            system.wallets.count * (i + 1) / threads, system.wallets.coins, std::ref(negativeWallets[i]));
+    }
+    size_t negativeWalletCount = 0;
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].join();
+        negativeWalletCount += negativeWallets[i];
+        delete[] chunks[i].net;
+        delete[] chunks[i].minimum;
+    }
+    delete[] negativeWallets;
+    delete[] workers;
+    delete[] chunks;
+
+    if (invalidTransactions > 0) {
+        std::cout << "Ledger validation: " << invalidTransactions
+            << " transactions move coins from or to unknown wallets" << std::endl;
+    }
+    if (negativeWalletCount > 0) {
+        std::cout << "Ledger validation: " << negativeWalletCount << " wallets had a negative balance" << std::endl;
+    }
+    return invalidTransactions == 0 && negativeWalletCount == 0;
+}
+
+void auditWallets(const System& system, const unsigned* walletIds, const size_t count, std::ostream& output) {
+    double* flows = new (std::nothrow) double[count > 0 ? count : 1];
+    ledgerNetFlows(system.transactions, walletIds, flows, count);
+    for (size_t i = 0; i < count; i++) {
+        long long position = findWalletPosition(system, walletIds[i]);
+        if (position == -1) {
+            output << "There is no wallet with ID: " << walletIds[i] << std::endl;
+            continue;
+        }
+        double cached = system.wallets.coins[position];
+        output << "Wallet ID " << walletIds[i] << ": cached " << cached << ", ledger " << flows[i]
+            << (isSameBalance(cached, flows[i]) ? " (consistent)" : " (MISMATCH)") << std::endl;
+    }
+    delete[] flows;
+}
+
+void siftDownByCoins(const double* coins, size_t* heap, const size_t count, size_t parent) {
+    while (true) {
+        size_t smallest = parent;
+        size_t left = parent * 2 + 1, right = parent * 2 + 2;
+        if (left < count && coins[heap[left]] < coins[heap[smallest]]) {
+            smallest = left;
+        }
+        if (right < count && coins[heap[right]] < coins[heap[smallest]]) {
+            smallest = right;
+        }
+        if (smallest == parent) {
+            return;
+        }
+        size_t swapPosition = heap[parent];
+        heap[parent] = heap[smallest];
+        heap[smallest] = swapPosition;
+        parent = smallest;
+    }
+}
+
+size_t selectRichestWallets(const System& system, size_t* positions, const size_t count) {
+    const double* coins = system.wallets.coins;
+    size_t selected = 0;
+    for (size_t i = 0; i < system.wallets.count && count > 0; i++) {
+        if (selected < count) {
+            positions[selected++] = i;
+            if (selected == count) {
+                for (size_t j = count / 2; j-- > 0;) {
+                    siftDownByCoins(coins, positions, count, j);
+                }
+            }
+        }
+        else if (coins[i] > coins[positions[0]]) {
+            positions[0] = i;
+            siftDownByCoins(coins, positions, count, 0);
+        }
+    }
+
+    for (size_t i = 1; i < selected; i++) {
+        size_t position = positions[i];
+        size_t j = i;
+        while (j > 0 && coins[positions[j - 1]] < coins[position]) {
+            positions[j] = positions[j - 1];
+            j--;
+        }
+        positions[j] = position;
+    }
+    return selected;
+}
+
+void updateLeaderboard(System& system, const size_t walletPosition, const bool increased) {
+    Leaderboard& leaderboard = system.leaderboard;
+    if (!leaderboard.valid) {
+        return;
+    }
+    const double* coins = system.wallets.coins;
+
+    size_t rank = leaderboard.count;
+    for (size_t i = 0; i < leaderboard.count; i++) {
+        if (leaderboard.positions[i] == walletPosition) {
+            rank = i;
+            break;
+        }
+    }
+
+    if (rank == leaderboard.count) {
+        if (!increased) {
+            return;
+        }
+        if (leaderboard.count < RICHEST_USERS_COUNT) {
+            leaderboard.count++;
+        }
+        else if (coins[walletPosition] <= coins[leaderboard.positions[rank - 1]]) {
+            if (coins[walletPosition] > leaderboard.outsideCoins) {
+                leaderboard.outsideCoins = coins[walletPosition];
+            }
+            return;
+        }
+        else {
+            rank--;
+            if (coins[leaderboard.positions[rank]] > leaderboard.outsideCoins) {
+                leaderboard.outsideCoins = coins[leaderboard.positions[rank]];
+            }
+        }
+    }
+    else if (!increased) {
+        while (rank + 1 < leaderboard.count && coins[leaderboard.positions[rank + 1]] > coins[walletPosition]) {
+            leaderboard.positions[rank] = leaderboard.positions[rank + 1];
+            rank++;
+        }
+        leaderboard.positions[rank] = walletPosition;
+        // outsideCoins bounds every non-member, so only a member sinking below it could be overtaken
+        if (rank + 1 == leaderboard.count && leaderboard.count < system.wallets.count &&
+            coins[walletPosition] < leaderboard.outsideCoins) {
+            leaderboard.valid = false;
+        }
+        return;
+    }
+
+    while (rank > 0 && coins[leaderboard.positions[rank - 1]] < coins[walletPosition]) {
+        leaderboard.positions[rank] = leaderboard.positions[rank - 1];
+        rank--;
+    }
+    leaderboard.positions[rank] = walletPosition;
+}
+
+size_t getFileSize(std::ifstream& file) {
+    size_t currentPosition = file.tellg();
+    file.seekg(0, std::ios::end);
+    size_t size = file.tellg();
+    file.seekg(currentPosition);
+    return size;
+}
+
+// Also reports how many carry-forward records the last kept segment left at the head of the live ledger
+template <typename T, typename IsStale>
+size_t findArchiveEnd(const char filename[], IsStale isStale, size_t& carryForwardCount) {
+    size_t validSize = 0;
+    size_t lastSegment = 0;
+    size_t lastCarryForwards = 0, previousCarryForwards = 0;
+    bool hasLastSegment = false;
+    T lastFirstRecord;
+    std::ifstream archiveFile(filename, std::ios::binary);
+    if (archiveFile.is_open()) {
+        size_t fileSize = getFileSize(archiveFile);
+        ArchiveHeader segment;
+        while (archiveFile.read((char*)&segment, sizeof(ArchiveHeader)) &&
+            memcmp(segment.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) == 0 && segment.version == ARCHIVE_VERSION &&
+            segment.recordSize == sizeof(T) && segment.count > 0) {
+            size_t segmentSize = sizeof(ArchiveHeader) + segment.count * sizeof(T) +
+                segment.carryForwardCount * sizeof(CarryForward);
+            if (validSize + segmentSize > fileSize || !archiveFile.read((char*)&lastFirstRecord, sizeof(T))) {
+                break;
+            }
+            lastSegment = validSize;
+            previousCarryForwards = lastCarryForwards;
+            lastCarryForwards = segment.carryForwardCount;
+            hasLastSegment = true;
+            validSize += segmentSize;
+            archiveFile.seekg(validSize);
+        }
+        archiveFile.close();
+    }
+    // A compaction interrupted before the live files were rewritten leaves a segment whose records are still live
+    carryForwardCount = lastCarryForwards;
+    if (hasLastSegment && isStale(lastFirstRecord, previousCarryForwards)) {
+        validSize = lastSegment;
+        carryForwardCount = previousCarryForwards;
+    }
+    return validSize;
+}
+
+template <typename T, typename IsStale, typename Visit>
+bool readArchive(const char filename[], IsStale isStale, Visit visit) {
+    size_t carryForwardCount;
+    size_t archiveEnd = findArchiveEnd<T>(filename, isStale, carryForwardCount);
+    if (archiveEnd == 0) {
+        return true;
+    }
+    std::ifstream archiveFile(filename, std::ios::binary);
+    T* records = new (std::nothrow) T[CHUNK_SIZE];
+    if (!archiveFile.is_open() || records == nullptr) {
+        delete[] records;
+        return false;
+    }
+    size_t position = 0;
+    ArchiveHeader segment;
+    while (position < archiveEnd && archiveFile.read((char*)&segment, sizeof(ArchiveHeader))) {
+        for (size_t read = 0; read < segment.count;) {
+            size_t run = segment.count - read < CHUNK_SIZE ? segment.count - read : CHUNK_SIZE;
+            if (!archiveFile.read((char*)records, run * sizeof(T))) {
+                delete[] records;
+                return false;
+            }
+            for (size_t i = 0; i < run; i++) {
+                visit(records[i]);
+            }
+            read += run;
+        }
+        position += sizeof(ArchiveHeader) + segment.count * sizeof(T) + segment.carryForwardCount * sizeof(CarryForward);
+        archiveFile.seekg(position);
+    }
+    delete[] records;
+    return true;
+}
+
+bool isLiveLedgerRecord(const TransactionContainer& transactions, const Transaction& record, const size_t position) {
+    if (position >= ledgerSize(transactions)) {
+        return false;
+    }
+    Transaction live = getTransaction(transactions, position);
+    return live.time == record.time && live.senderId == record.senderId && live.receiverId == record.receiverId &&
+        live.grnCoins == record.grnCoins;
+}
+
+void addToWalletHistory(WalletHistory& history, const size_t transactionPosition) {
+    if (history.count == history.capacity) {
+        size_t* newPositions = new (std::nothrow) size_t[history.capacity = history.capacity * 2 + INITIAL_CAPACITY];
+        for (size_t i = 0; i < history.count; i++) {
+            newPositions[i] = history.positions[i];
+        }
+        delete[] history.positions;
+        history.positions = newPositions;
+    }
+    history.positions[history.count++] = transactionPosition;
+}
+
+void indexTransaction(System& system, const Transaction& transaction, const size_t transactionPosition) {
+    long long senderPosition = findWalletPosition(system, transaction.senderId);
+    if (senderPosition != -1) {
+        addToWalletHistory(system.wallets.histories[senderPosition], transactionPosition);
+    }
+    long long receiverPosition = findWalletPosition(system, transaction.receiverId);
+    if (receiverPosition != -1 && receiverPosition != senderPosition) {
+        addToWalletHistory(system.wallets.histories[receiverPosition], transactionPosition);
+    }
+}
+
+void indexWalletHistories(System& system) {
+    if (system.wallets.historiesIndexed) {
+        return;
+    }
+    for (size_t i = 0; i < ledgerSize(system.transactions); i++) {
+        indexTransaction(system, getTransaction(system.transactions, i), i);
+    }
+    system.wallets.historiesIndexed = true;
+}
+
+template <typename Visit>
+bool readLedgerArchive(const System& system, Visit visit) {
+    return readArchive<Transaction>(TRANSACTIONS_ARCHIVE_FILENAME,
+        [&](const Transaction& record, const size_t previousCarryForwards) {
+            return isLiveLedgerRecord(system.transactions, record, previousCarryForwards);
+        },
+        visit);
+}
+
+void addToArchivedHistory(WalletHistory& history, const long long time) {
+    if (history.archivedCount++ == 0) {
+        history.archivedFirstTime = time;
+    }
+    history.archivedLastTime = time;
+}
+
+bool indexWalletArchive(System& system) {
+    if (system.wallets.archiveIndexed) {
+        return true;
+    }
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        system.wallets.histories[i].archivedCount = 0;
+    }
+    auto isStale = [&](const Transaction& first, const size_t previousCarryForwards) {
+        return isLiveLedgerRecord(system.transactions, first, previousCarryForwards);
+    };
+    size_t carriedForward = 0;
+    findArchiveEnd<Transaction>(TRANSACTIONS_ARCHIVE_FILENAME, isStale, carriedForward);
+    bool complete = readLedgerArchive(system, [&](const Transaction& transaction) {
+        long long senderPosition = findWalletPosition(system, transaction.senderId);
+        if (senderPosition != -1) {
+            addToArchivedHistory(system.wallets.histories[senderPosition], transaction.time);
+        }
+        long long receiverPosition = findWalletPosition(system, transaction.receiverId);
+        if (receiverPosition != -1 && receiverPosition != senderPosition) {
+            addToArchivedHistory(system.wallets.histories[receiverPosition], transaction.time);
+        }
+    });
+    if (!complete) {
+        for (size_t i = 0; i < system.wallets.count; i++) {
+            system.wallets.histories[i].archivedCount = 0;
+        }
+        carriedForward = 0;
+    }
+    system.wallets.carriedForward = carriedForward;
+    system.wallets.archiveIndexed = complete;
+    return complete;
+}
+
+// Carry-forwards stand in for archived entries, so they are left out when the archive is shown
+size_t carriedForwardEntries(const System& system, const WalletHistory& history) {
+    return history.count > 0 && history.positions[0] < system.wallets.carriedForward ? 1 : 0;
+}
+
+const WalletHistory* findWalletHistory(System& system, const unsigned walletId) {
+    long long position = findWalletPosition(system, walletId);
+    if (position == -1) {
+        return nullptr;
+    }
+    indexWalletHistories(system);
+    return &system.wallets.histories[position];
+}
+
+void appendLedgerRecord(TransactionContainer& transactions, const Transaction& transaction) {
+    transactions.times[transactions.count] = transaction.time;
+    transactions.senderIds[transactions.count] = transaction.senderId;
+    transactions.receiverIds[transactions.count] = transaction.receiverId;
+    transactions.grnCoins[transactions.count++] = transaction.grnCoins;
+    COUNT_EVENT(TRANSACTIONS_APPENDED, 1);
+}
+
+bool appendTransaction(System& system, const Transaction& transaction) {
+    TransactionContainer& transactions = system.transactions;
+    if (transactions.count == transactions.capacity && !resizeTransactionContainer(transactions)) {
+        return false;
+    }
+    appendLedgerRecord(transactions, transaction);
+    applyTransaction(system, system.wallets.coins, transaction);
+    if (system.wallets.historiesIndexed) {
+        indexTransaction(system, transaction, ledgerSize(transactions) - 1);
+    }
+
+    long long senderPosition = findWalletPosition(system, transaction.senderId);
+    if (senderPosition != -1) {
+        updateLeaderboard(system, senderPosition, false);
+    }
+    long long receiverPosition = findWalletPosition(system, transaction.receiverId);
+    if (receiverPosition != -1) {
+        updateLeaderboard(system, receiverPosition, true);
+    }
+    return true;
+}
+
+bool checkBalances(const System& system, std::ostream& output) {
+    double* ledgerCoins = new (std::nothrow) double[system.wallets.capacity];
+    accumulateBalances(system, ledgerCoins);
+
+    bool consistent = true;
+    unsigned long long checksum = LEDGER_CHECKSUM_SEED;
+    for (size_t i = 0; i < system.transactions.persistedCount; i++) {
+        Transaction transaction = getTransaction(system.transactions, i);
+        checksum = ledgerChecksum(checksum, &transaction, 1);
+    }
+    if (checksum != system.transactions.checksum) {
+        output << "Ledger checksum mismatch in " << TRANSACTIONS_FILENAME << std::endl;
+        consistent = false;
+    }
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        if (!isSameBalance(ledgerCoins[i], system.wallets.coins[i])) {
+            output << "Balance mismatch for wallet ID " << system.wallets.items[i].id
+                << ": cached " << system.wallets.coins[i] << ", ledger " << ledgerCoins[i] << std::endl;
+            consistent = false;
+        }
+    }
+    delete[] ledgerCoins;
+    return consistent;
+}
+
+double buyerUsableMoney(const System& system, const unsigned walletId) {
+    long long position = findWalletPosition(system, walletId);
+    return system.wallets.items[position].fiatMoney - system.wallets.reservedFiat[position];
+}
+
+double sellerUsableCoins(const System& system, const unsigned walletId) {
+    long long position = findWalletPosition(system, walletId);
+    return system.wallets.coins[position] - system.wallets.reservedCoins[position];
+}
+
+bool canTransfer(const System& system, const unsigned senderId, const unsigned receiverId, const double grnCoins) {
+    return grnCoins > 0 && findWallet(system, receiverId) != nullptr && (senderId == SYSTEM_WALLET_ID ||
+        (findWallet(system, senderId) != nullptr && sellerUsableCoins(system, senderId) >= grnCoins));
+}
+
+bool applyTransfer(System& system, const unsigned senderId, const unsigned receiverId, const double grnCoins,
+    const long long time) {
+    Transaction transaction;
+    transaction.senderId = senderId;
+    transaction.receiverId = receiverId;
+    transaction.grnCoins = grnCoins;
+    transaction.time = time;
+    return appendTransaction(system, transaction);
+}
+
+bool transferAt(System& system, const unsigned senderId, const unsigned receiverId, const double grnCoins,
+    const long long time) {
+    return canTransfer(system, senderId, receiverId, grnCoins) && applyTransfer(system, senderId, receiverId, grnCoins, time);
+}
+
+bool transfer(System& system, const unsigned senderId, const unsigned receiverId, const double grnCoins) {
+    MEASURE_LATENCY(TRANSFER);
+    if (!canTransfer(system, senderId, receiverId, grnCoins)) {
+        return false;
+    }
+
+    long long time = getTime();
+    JournalRecord record = makeJournalRecord(JournalRecord::Type::TRANSFER, time);
+    record.walletId = senderId;
+    record.otherWalletId = receiverId;
+    record.amount = grnCoins;
+    return appendJournalRecord(system.journal, record, "") && applyTransfer(system, senderId, receiverId, grnCoins, time);
+}
+
+bool canTransferBatch(const System& system, const TransferRequest* transfers, const size_t count) {
+    WalletDebit* debits = new (std::nothrow) WalletDebit[count > 0 ? count : 1];
+    bool valid = debits != nullptr && count > 0;
+    size_t debitCount = 0;
+    for (size_t i = 0; valid && i < count; i++) {
+        long long senderPosition = findWalletPosition(system, transfers[i].senderId);
+        valid = transfers[i].grnCoins > 0 && findWalletPosition(system, transfers[i].receiverId) != -1 &&
+            (senderPosition != -1 || transfers[i].senderId == SYSTEM_WALLET_ID);
+        if (valid && senderPosition != -1) {
+            debits[debitCount++] = { senderPosition, transfers[i].grnCoins };
+        }
+    }
+
+    if (valid) {
+        std::sort(debits, debits + debitCount, [](const WalletDebit& debit, const WalletDebit& otherDebit) {
+            return debit.position < otherDebit.position;
+        });
+    }
+    for (size_t first = 0, last = 0; valid && first < debitCount; first = last) {
+        double grnCoins = 0;
+        for (last = first; last < debitCount && debits[last].position == debits[first].position; last++) {
+            grnCoins += debits[last].grnCoins;
+        }
+        valid = system.wallets.coins[debits[first].position] - system.wallets.reservedCoins[debits[first].position] >= grnCoins;
+    }
+    delete[] debits;
+    return valid;
+}
+
+bool reserveTransactions(TransactionContainer& transactions, const size_t count) {
+    while (transactions.capacity < transactions.count + count) {
+        if (!resizeTransactionContainer(transactions)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void applyTransferBatch(System& system, const TransferRequest* transfers, const size_t count, const long long time) {
+    for (size_t i = 0; i < count; i++) {
+        applyTransfer(system, transfers[i].senderId, transfers[i].receiverId, transfers[i].grnCoins, time);
+    }
+}
+
+bool transferBatchAt(System& system, const TransferRequest* transfers, const size_t count, const long long time) {
+    if (!canTransferBatch(system, transfers, count) || !reserveTransactions(system.transactions, count)) {
+        return false;
+    }
+    applyTransferBatch(system, transfers, count, time);
+    return true;
+}
+
+bool transferBatch(System& system, const TransferRequest* transfers, const size_t count) {
+    if (!canTransferBatch(system, transfers, count) || !reserveTransactions(system.transactions, count)) {
+        return false;
+    }
+
+    JournalRecord* records = new (std::nothrow) JournalRecord[count + 1];
+    if (records == nullptr) {
+        return false;
+    }
+    long long time = getTime();
+    records[0] = makeJournalRecord(JournalRecord::Type::TRANSFER_BATCH, time);
+    records[0].amount = (double)count;
+    for (size_t i = 0; i < count; i++) {
+        records[i + 1] = makeJournalRecord(JournalRecord::Type::TRANSFER, time);
+        records[i + 1].walletId = transfers[i].senderId;
+        records[i + 1].otherWalletId = transfers[i].receiverId;
+        records[i + 1].amount = transfers[i].grnCoins;
+    }
+    bool syncDue = false;
+    bool journaled = writeJournalRecords(system.journal, records, count + 1, syncDue) &&
+        commitJournal(system.journal, syncDue);
+    delete[] records;
+    if (!journaled) {
+        return false;
+    }
+    applyTransferBatch(system, transfers, count, time);
+    return true;
+}
+
+bool createWallet(System& system, const unsigned walletId, const double fiatMoney, const char name[],
+    const long long time) {
+    if ((system.wallets.count == system.wallets.capacity && !resizeWalletContainer(system, system.wallets.capacity * 2)) ||
+        !reserveTransactions(system.transactions, 1)) {
+        return false;
+    }
+    long long ownerOffset = internName(system.wallets.owners, name);
+    if (ownerOffset == -1) {
+        return false;
+    }
+
+    Wallet wallet;
+    wallet.ownerOffset = (unsigned)ownerOffset;
+    wallet.id = walletId;
+    wallet.fiatMoney = fiatMoney;
+    system.wallets.items[system.wallets.count] = wallet;
+    system.wallets.executedOrders[system.wallets.count] = 0;
+    system.wallets.coins[system.wallets.count] = 0;
+    system.wallets.reservedFiat[system.wallets.count] = 0;
+    system.wallets.reservedCoins[system.wallets.count] = 0;
+    system.wallets.histories[system.wallets.count] = { nullptr, 0, 0, 0, -1, -1 };
+    system.wallets.volumes[system.wallets.count] = { 0, 0, 0, 0 };
+    insertWalletIndex(system.wallets, system.wallets.count++);
+
+    return applyTransfer(system, SYSTEM_WALLET_ID, wallet.id, wallet.fiatMoney / EXCHANGE_RATE, time);
+}
+
+long long addWallet(System& system, const double fiatMoney, const char name[]) {
+    if (strlen(name) <= 255 && fiatMoney >= 0) {
+        unsigned walletId;
+        do {
+            walletId = generateId(system.ids);
+        }
+        while (walletId == SYSTEM_WALLET_ID || findWallet(system, walletId));
+
+        long long time = getTime();
+        JournalRecord record = makeJournalRecord(JournalRecord::Type::ADD_WALLET, time);
+        record.walletId = walletId;
+        record.amount = fiatMoney;
+        record.nameLength = (unsigned)strlen(name);
+        if (appendJournalRecord(system.journal, record, name) && createWallet(system, walletId, fiatMoney, name, time)) {
+            return walletId;
+        }
+    }
+    return -1;
+}
+
+void walletInfo(const System& system, const unsigned walletId, std::ostream& output) {
+    MEASURE_LATENCY(WALLET_INFO);
+    Wallet* wallet = findWallet(system, walletId);
+    if (wallet != nullptr) {
+        output << "Owner: " << getOwner(system.wallets, *wallet) << std::endl;
+        output << "Fiat money: " << wallet->fiatMoney << std::endl;
+        output << "GRN coins: " << getCoins(system, walletId) << std::endl;
+    }
+    else {
+        output << "There is no wallet with ID: " << walletId << std::endl;
+    }
+}
+
+size_t executedOrders(const System& system, const unsigned walletId) {
+    long long position = findWalletPosition(system, walletId);
+    if (position != -1) {
+        return system.wallets.executedOrders[position];
+    }
+    return 0;
+}
+
+long long getTimeFirstOrder(System& system, const unsigned walletId) {
+    const WalletHistory* history = findWalletHistory(system, walletId);
+    if (history == nullptr) {
+        return -1;
+    }
+    indexWalletArchive(system);
+    if (history->archivedCount > 0) {
+        return history->archivedFirstTime;
+    }
+    size_t skipped = carriedForwardEntries(system, *history);
+    if (history->count == skipped) {
+        return -1;
+    }
+    return getTransaction(system.transactions, history->positions[skipped]).time;
+}
+
+long long getTimeLastOrder(System& system, const unsigned walletId) {
+    const WalletHistory* history = findWalletHistory(system, walletId);
+    if (history == nullptr) {
+        return -1;
+    }
+    indexWalletArchive(system);
+    if (history->count > carriedForwardEntries(system, *history)) {
+        return getTransaction(system.transactions, history->positions[history->count - 1]).time;
+    }
+    return history->archivedCount > 0 ? history->archivedLastTime : -1;
+}
+
+void walletHistory(System& system, const unsigned walletId, const size_t from, const size_t to, std::ostream& output) {
+    const WalletHistory* history = findWalletHistory(system, walletId);
+    if (history == nullptr) {
+        output << "There is no wallet with ID: " << walletId << std::endl;
+        return;
+    }
+
+    if (!indexWalletArchive(system)) {
+        output << "Could not read " << TRANSACTIONS_ARCHIVE_FILENAME << ", showing live entries only" << std::endl;
+    }
+    // Archived entries come first, followed by the live ones
+    size_t skipped = carriedForwardEntries(system, *history);
+    size_t archivedCount = history->archivedCount;
+    size_t total = archivedCount + history->count - skipped;
+    size_t first = from < total ? from : total;
+    size_t last = to < total ? to : total;
+    if (last < first) {
+        last = first;
+    }
+    output << "Entries " << first << "-" << last << " of " << total << std::endl;
+    if (first < archivedCount) {
+        size_t position = 0;
+        readLedgerArchive(system, [&](const Transaction& transaction) {
+            if (transaction.senderId != walletId && transaction.receiverId != walletId) {
+                return;
+            }
+            if (position >= first && position < last) {
+                output << transaction.time << " " << transaction.senderId << " -> " << transaction.receiverId
+                    << " " << transaction.grnCoins << std::endl;
+            }
+            position++;
+        });
+    }
+    for (size_t i = first > archivedCount ? first : archivedCount; i < last; i++) {
+        Transaction transaction = getTransaction(system.transactions, history->positions[i - archivedCount + skipped]);
+        output << transaction.time << " " << transaction.senderId << " -> " << transaction.receiverId
+            << " " << transaction.grnCoins << std::endl;
+    }
+}
+
+void richUserInfo(System& system, const unsigned walletId, std::ostream& output) {
+    Wallet* wallet = findWallet(system, walletId);
+    if (wallet != nullptr) {
+        output << "Owner: " << getOwner(system.wallets, *wallet) << std::endl;
+        output << "Wallet ID: " << wallet->id << std::endl;
+        output << "GRN coins: " << getCoins(system, walletId) << std::endl;
+        size_t executedOrdersCount = executedOrders(system, walletId);
+        output << "Executed orders: " << executedOrdersCount << std::endl;
+        if (executedOrdersCount!=0) {
+            output << "First order executed at: " << getTimeFirstOrder(system, walletId) << std::endl;
+            output << "Last order executed at: " << getTimeLastOrder(system, walletId) << std::endl;
+        }
+    }
+    else {
+        output << "There is no wallet with ID: " << walletId << std::endl;
+    }
+}
+
+void attractInvestors(System& system, std::ostream& output) {
+    Leaderboard& leaderboard = system.leaderboard;
+    if (!leaderboard.valid) {
+        leaderboard.count = selectRichestWallets(system, leaderboard.positions, RICHEST_USERS_COUNT);
+        leaderboard.outsideCoins = leaderboard.count == RICHEST_USERS_COUNT ?
+            system.wallets.coins[leaderboard.positions[leaderboard.count - 1]] : 0;
+        leaderboard.valid = true;
+    }
+    for (size_t i = 0; i < leaderboard.count; i++) {
+        richUserInfo(system, system.wallets.items[leaderboard.positions[i]].id, output);
+    }
+}
+
+void flushReport(ReportWriter& writer) {
+    if (writer.size > 0 && fwrite(writer.buffer, 1, writer.size, writer.file) != writer.size) {
+        writer.failed = true;
+    }
+    writer.size = 0;
+}
+
+char* reserveReport(ReportWriter& writer, const size_t length) {
+    if (writer.size + length > REPORT_BUFFER_SIZE) {
+        flushReport(writer);
+    }
+    return writer.buffer + writer.size;
+}
+
+void writeReportBytes(ReportWriter& writer, const char* data, const size_t length) {
+    if (length > REPORT_BUFFER_SIZE) {
+        flushReport(writer);
+        if (fwrite(data, 1, length, writer.file) != length) {
+            writer.failed = true;
+        }
+        return;
+    }
+    memcpy(reserveReport(writer, length), data, length);
+    writer.size += length;
+}
+
+void writeReportText(ReportWriter& writer, const char text[]) {
+    writeReportBytes(writer, text, strlen(text));
+}
+
+template <typename T>
+void writeReportNumber(ReportWriter& writer, const T number) {
+    char* begin = reserveReport(writer, 32);
+    writer.size += std::to_chars(begin, begin + 32, number).ptr - begin;
+}
+
+void writeReportString(ReportWriter& writer, const char text[]) {
+    char* output = reserveReport(writer, MAX_REPORT_FIELD_LENGTH);
+    char* begin = output;
+    *output++ = '"';
+    for (const char* character = text; *character != '\0'; character++) {
+        if (*character == '"') {
+            *output++ = writer.format == ReportOptions::Format::CSV ? '"' : '\\';
+        }
+        else if (*character == '\\' && writer.format == ReportOptions::Format::JSON) {
+            *output++ = '\\';
+        }
+        *output++ = *character;
+    }
+    *output++ = '"';
+    writer.size += output - begin;
+}
+
+void writeWalletRecord(ReportWriter& writer, const System& system, const size_t position) {
+    const Wallet& wallet = system.wallets.items[position];
+    if (writer.format == ReportOptions::Format::CSV) {
+        writeReportText(writer, "wallet,");
+        writeReportNumber(writer, wallet.id);
+        writeReportText(writer, ",");
+        writeReportString(writer, getOwner(system.wallets, wallet));
+        writeReportText(writer, ",");
+        writeReportNumber(writer, wallet.fiatMoney);
+        writeReportText(writer, ",,,,");
+        writeReportNumber(writer, system.wallets.coins[position]);
+        writeReportText(writer, "\n");
+    }
+    else {
+        writeReportText(writer, "{\"record\":\"wallet\",\"id\":");
+        writeReportNumber(writer, wallet.id);
+        writeReportText(writer, ",\"owner\":");
+        writeReportString(writer, getOwner(system.wallets, wallet));
+        writeReportText(writer, ",\"fiatMoney\":");
+        writeReportNumber(writer, wallet.fiatMoney);
+        writeReportText(writer, ",\"grnCoins\":");
+        writeReportNumber(writer, system.wallets.coins[position]);
+        writeReportText(writer, "}\n");
+    }
+}
+
+void writeTransactionRecord(ReportWriter& writer, const Transaction& transaction) {
+    if (writer.format == ReportOptions::Format::CSV) {
+        writeReportText(writer, "transaction,,,,");
+        writeReportNumber(writer, transaction.time);
+        writeReportText(writer, ",");
+        writeReportNumber(writer, transaction.senderId);
+        writeReportText(writer, ",");
+        writeReportNumber(writer, transaction.receiverId);
+        writeReportText(writer, ",");
+        writeReportNumber(writer, transaction.grnCoins);
+        writeReportText(writer, "\n");
+    }
+    else {
+        writeReportText(writer, "{\"record\":\"transaction\",\"time\":");
+        writeReportNumber(writer, transaction.time);
+        writeReportText(writer, ",\"senderId\":");
+        writeReportNumber(writer, transaction.senderId);
+        writeReportText(writer, ",\"receiverId\":");
+        writeReportNumber(writer, transaction.receiverId);
+        writeReportText(writer, ",\"grnCoins\":");
+        writeReportNumber(writer, transaction.grnCoins);
+        writeReportText(writer, "}\n");
+    }
+}
+
+long long generateTextFile(System& system, const ReportOptions& options) {
+    ReportWriter writer;
+    writer.file = fopen(options.filename, "wb");
+    if (writer.file == nullptr) {
+        return -1;
+    }
+    writer.buffer = new (std::nothrow) char[REPORT_BUFFER_SIZE];
+    if (writer.buffer == nullptr) {
+        fclose(writer.file);
+        return -1;
+    }
+    writer.size = 0;
+    writer.format = options.format;
+    writer.failed = false;
+
+    long long records = 0;
+    if (options.format == ReportOptions::Format::CSV) {
+        writeReportText(writer, "record,walletId,owner,fiatMoney,time,senderId,receiverId,grnCoins\n");
+    }
+
+    // Archived transactions come first; the carry-forwards that stand in for them are left out
+    indexWalletArchive(system);
+    auto writeArchived = [&](const Transaction& transaction) {
+        if ((!options.filterWallet || transaction.senderId == options.walletId || transaction.receiverId == options.walletId) &&
+            transaction.time >= options.from && transaction.time <= options.to) {
+            writeTransactionRecord(writer, transaction);
+            records++;
+        }
+    };
+    if (options.filterWallet) {
+        const WalletHistory* history = findWalletHistory(system, options.walletId);
+        if (history != nullptr) {
+            writeWalletRecord(writer, system, findWalletPosition(system, options.walletId));
+            records++;
+            if (!readLedgerArchive(system, writeArchived)) {
+                writer.failed = true;
+            }
+            for (size_t i = carriedForwardEntries(system, *history); i < history->count; i++) {
+                Transaction transaction = getTransaction(system.transactions, history->positions[i]);
+                if (transaction.time >= options.from && transaction.time <= options.to) {
+                    writeTransactionRecord(writer, transaction);
+                    records++;
+                }
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < system.wallets.count; i++) {
+            writeWalletRecord(writer, system, i);
+            records++;
+        }
+        if (!readLedgerArchive(system, writeArchived)) {
+            writer.failed = true;
+        }
+        for (size_t i = system.wallets.carriedForward; i < ledgerSize(system.transactions); i++) {
+            Transaction transaction = getTransaction(system.transactions, i);
+            if (transaction.time >= options.from && transaction.time <= options.to) {
+                writeTransactionRecord(writer, transaction);
+                records++;
+            }
+        }
+    }
+
+    flushReport(writer);
+    if (fclose(writer.file) != 0) {
+        writer.failed = true;
+    }
+    delete[] writer.buffer;
+    return writer.failed ? -1 : records;
+}
+
+bool resizeOrderBook(OrderBook& book) {
+    size_t capacity = book.capacity > 0 ? book.capacity * 2 : INITIAL_CAPACITY;
+    PriceLevel* newLevels = new (std::nothrow) PriceLevel[capacity];
+    if (newLevels == nullptr) {
+        return false;
+    }
+    COUNT_EVENT(PRICE_LEVEL_RESIZES, 1);
+    for (size_t i = 0; i < book.count; i++) {
+        newLevels[i] = book.levels[i];
+    }
+    delete[] book.levels;
+    book.levels = newLevels;
+    book.capacity = capacity;
+    return true;
+}
+
+bool isWorsePrice(const OrderBook& book, const double price, const double otherPrice) {
+    if (book.side == Order::Type::BUY) {
+        return price < otherPrice;
+    }
+    return price > otherPrice;
+}
+
+size_t findPriceLevel(const OrderBook& book, const double price) {
+    size_t left = 0, right = book.count;
+    while (left < right) {
+        size_t middle = left + (right - left) / 2;
+        if (isWorsePrice(book, book.levels[middle].price, price)) {
+            left = middle + 1;
+        }
+        else {
+            right = middle;
+        }
+    }
+    return left;
+}
+
+bool addToBook(System& system, const size_t orderPosition) {
+    const Order& order = system.orders.items[orderPosition];
+    OrderBook& book = order.type == Order::Type::BUY ? system.bids : system.asks;
+    system.orders.next[orderPosition] = NO_ORDER;
+    system.orders.previous[orderPosition] = NO_ORDER;
+
+    size_t levelPosition = findPriceLevel(book, order.price);
+    if (levelPosition < book.count && book.levels[levelPosition].price == order.price) {
+        PriceLevel& level = book.levels[levelPosition];
+        system.orders.next[level.tail] = orderPosition;
+        system.orders.previous[orderPosition] = level.tail;
+        level.tail = orderPosition;
+        return true;
+    }
+
+    if (book.count == book.capacity && !resizeOrderBook(book)) {
+        return false;
+    }
+    for (size_t i = book.count; i > levelPosition; i--) {
+        book.levels[i] = book.levels[i - 1];
+    }
+    book.levels[levelPosition].price = order.price;
+    book.levels[levelPosition].head = orderPosition;
+    book.levels[levelPosition].tail = orderPosition;
+    book.count++;
+    return true;
+}
+
+void reserveOrder(System& system, const Order& order, const double grnCoins) {
+    long long position = findWalletPosition(system, order.walletId);
+    if (order.type == Order::Type::BUY) {
+        system.wallets.reservedFiat[position] += grnCoins * order.price;
+    }
+    else {
+        system.wallets.reservedCoins[position] += grnCoins;
+    }
+}
+
+void releaseOrder(System& system, const Order& order, const double grnCoins) {
+    reserveOrder(system, order, -grnCoins);
+}
+
+void rebuildReservations(System& system) {
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        system.wallets.reservedFiat[i] = 0;
+        system.wallets.reservedCoins[i] = 0;
+    }
+    for (size_t i = 0; i < system.orders.count; i++) {
+        if (!system.orders.executed[i] && system.orders.items[i].remainingCoins > 0) {
+            reserveOrder(system, system.orders.items[i], system.orders.items[i].remainingCoins);
+        }
+    }
+}
+
+void removeBestOrder(System& system, OrderBook& book, const long long time) {
+    PriceLevel& level = book.levels[book.count - 1];
+    const Order& order = system.orders.items[level.head];
+    if (order.remainingCoins > 0) {
+        releaseOrder(system, order, order.remainingCoins);
+    }
+    system.orders.executed[level.head] = true;
+    system.orders.times[level.head] = time;
+    level.head = system.orders.next[level.head];
+    if (level.head == NO_ORDER) {
+        book.count--;
+    }
+    else {
+        system.orders.previous[level.head] = NO_ORDER;
+    }
+}
+
+void removeFromBook(System& system, const size_t orderPosition) {
+    const Order& order = system.orders.items[orderPosition];
+    OrderBook& book = order.type == Order::Type::BUY ? system.bids : system.asks;
+    size_t levelPosition = findPriceLevel(book, order.price);
+    PriceLevel& level = book.levels[levelPosition];
+    size_t next = system.orders.next[orderPosition];
+    size_t previous = system.orders.previous[orderPosition];
+    if (previous == NO_ORDER) {
+        level.head = next;
+    }
+    else {
+        system.orders.next[previous] = next;
+    }
+    if (next == NO_ORDER) {
+        level.tail = previous;
+    }
+    else {
+        system.orders.previous[next] = previous;
+    }
+
+    if (level.head == NO_ORDER) {
+        for (size_t i = levelPosition; i + 1 < book.count; i++) {
+            book.levels[i] = book.levels[i + 1];
+        }
+        book.count--;
+    }
+}
+
+bool rebuildOrderBooks(System& system) {
+    system.bids.count = 0;
+    system.asks.count = 0;
+    for (size_t i = 0; i < system.orders.count; i++) {
+        if (!system.orders.executed[i] && system.orders.items[i].remainingCoins > 0 && !addToBook(system, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void settleFill(System& system, const Fill& fill) {
+    Transaction transaction;
+    transaction.senderId = fill.sellerId;
+    transaction.receiverId = fill.buyerId;
+    transaction.grnCoins = fill.grnCoins;
+    transaction.time = fill.time;
+    appendTransaction(system, transaction);
+
+    findWallet(system, fill.buyerId)->fiatMoney -= fill.grnCoins * fill.price;
+    findWallet(system, fill.sellerId)->fiatMoney += fill.grnCoins * fill.price;
+}
+
+bool initMarketData(MarketData& market) {
+    bool allocated = true;
+    for (size_t i = 0; i < MARKET_INTERVAL_COUNT; i++) {
+        BarSeries& series = market.series[i];
+        series.interval = MARKET_INTERVALS[i];
+        series.bars = new (std::nothrow) MarketBar[MARKET_BAR_COUNT];
+        series.newest = MARKET_BAR_COUNT - 1;
+        series.count = 0;
+        series.windowVolume = 0;
+        series.windowNotional = 0;
+        series.windowTrades = 0;
+        allocated = allocated && series.bars != nullptr;
+    }
+    return allocated;
+}
+
+void advanceBars(BarSeries& series, const long long start) {
+    long long newestStart = series.count > 0 ? series.bars[series.newest].start : start - series.interval;
+    if (start <= newestStart) {
+        return;
+    }
+    if ((start - newestStart) / series.interval >= (long long)MARKET_BAR_COUNT) {
+        series.count = 0;
+        series.windowVolume = 0;
+        series.windowNotional = 0;
+        series.windowTrades = 0;
+        newestStart = start - series.interval;
+    }
+    while (newestStart < start) {
+        series.newest = (series.newest + 1) % MARKET_BAR_COUNT;
+        if (series.count == MARKET_BAR_COUNT) {
+            const MarketBar& evicted = series.bars[series.newest];
+            series.windowVolume -= evicted.volume;
+            series.windowNotional -= evicted.notional;
+            series.windowTrades -= evicted.trades;
+        }
+        else {
+            series.count++;
+        }
+        newestStart += series.interval;
+        series.bars[series.newest] = { newestStart, 0, 0, 0, 0, 0, 0, 0 };
+    }
+}
+
+void addToBars(BarSeries& series, const long long time, const double price, const double grnCoins) {
+    long long start = time - time % series.interval;
+    advanceBars(series, start);
+    long long age = (series.bars[series.newest].start - start) / series.interval;
+    if (age >= (long long)series.count) {
+        return;
+    }
+
+    MarketBar& bar = series.bars[(series.newest + MARKET_BAR_COUNT - age) % MARKET_BAR_COUNT];
+    if (bar.trades == 0) {
+        bar.open = price;
+        bar.high = price;
+        bar.low = price;
+        bar.close = price;
+    }
+    else if (age == 0) {
+        bar.close = price;
+    }
+    bar.high = price > bar.high ? price : bar.high;
+    bar.low = price < bar.low ? price : bar.low;
+    bar.volume += grnCoins;
+    bar.notional += grnCoins * price;
+    bar.trades++;
+    series.windowVolume += grnCoins;
+    series.windowNotional += grnCoins * price;
+    series.windowTrades++;
+}
+
+void recordFill(System& system, const Fill& fill) {
+    for (size_t i = 0; i < MARKET_INTERVAL_COUNT; i++) {
+        if (system.market.series[i].bars != nullptr) {
+            addToBars(system.market.series[i], fill.time, fill.price, fill.grnCoins);
+        }
+    }
+    long long buyerPosition = findWalletPosition(system, fill.buyerId);
+    if (buyerPosition != -1) {
+        WalletVolume& volume = system.wallets.volumes[buyerPosition];
+        volume.boughtCoins += fill.grnCoins;
+        volume.fiatVolume += fill.grnCoins * fill.price;
+        volume.fills++;
+    }
+    long long sellerPosition = findWalletPosition(system, fill.sellerId);
+    if (sellerPosition != -1) {
+        WalletVolume& volume = system.wallets.volumes[sellerPosition];
+        volume.soldCoins += fill.grnCoins;
+        volume.fiatVolume += fill.grnCoins * fill.price;
+        volume.fills++;
+    }
+}
+
+void marketStats(System& system, const long long interval, std::ostream& output) {
+    BarSeries* series = nullptr;
+    for (size_t i = 0; i < MARKET_INTERVAL_COUNT; i++) {
+        if (MARKET_INTERVALS[i] == interval) {
+            series = &system.market.series[i];
+        }
+    }
+    if (series == nullptr) {
+        output << "Unsupported interval, use 60, 300, 3600 or 86400 seconds" << std::endl;
+        return;
+    }
+    if (series->bars == nullptr) {
+        output << "Market data for this interval is unavailable" << std::endl;
+        return;
+    }
+
+    long long now = getTime();
+    advanceBars(*series, now - now % series->interval);
+    output << "Interval: " << interval << " s, window of " << series->count << " bars" << std::endl;
+    output << "Volume: " << series->windowVolume << " GRN coins in " << series->windowTrades << " trades" << std::endl;
+    if (series->windowTrades > 0) {
+        output << "VWAP: " << series->windowNotional / series->windowVolume << std::endl;
+    }
+    size_t shown = 0;
+    for (size_t age = 0; age < series->count && shown < RECENT_BAR_COUNT; age++) {
+        const MarketBar& bar = series->bars[(series->newest + MARKET_BAR_COUNT - age) % MARKET_BAR_COUNT];
+        if (bar.trades == 0) {
+            continue;
+        }
+        output << bar.start << " open " << bar.open << " high " << bar.high << " low " << bar.low << " close " << bar.close
+            << " volume " << bar.volume << " VWAP " << bar.notional / bar.volume << " trades " << bar.trades << std::endl;
+        shown++;
+    }
+}
+
+void walletStats(const System& system, const unsigned walletId, std::ostream& output) {
+    long long position = findWalletPosition(system, walletId);
+    if (position == -1) {
+        output << "There is no wallet with ID: " << walletId << std::endl;
+        return;
+    }
+
+    const WalletVolume& volume = system.wallets.volumes[position];
+    output << "Owner: " << getOwner(system.wallets, system.wallets.items[position]) << std::endl;
+    output << "Executed orders: " << system.wallets.executedOrders[position] << std::endl;
+    output << "Fills: " << volume.fills << std::endl;
+    output << "Bought GRN coins: " << volume.boughtCoins << std::endl;
+    output << "Sold GRN coins: " << volume.soldCoins << std::endl;
+    output << "Traded fiat volume: " << volume.fiatVolume << std::endl;
+    if (volume.fills > 0) {
+        output << "Average price: " << volume.fiatVolume / (volume.boughtCoins + volume.soldCoins) << std::endl;
+    }
+}
+
+void countExecutedOrder(System& system, const Order& order) {
+    long long position = findWalletPosition(system, order.walletId);
+    if (position != -1) {
+        system.wallets.executedOrders[position]++;
+    }
+}
+
+void executeOrders(System& system, const size_t orderPosition, const long long time) {
+    MEASURE_LATENCY(EXECUTE_ORDERS);
+    Order& order = system.orders.items[orderPosition];
+    OrderBook& book = order.type == Order::Type::BUY ? system.asks : system.bids;
+
+    while (order.remainingCoins > 0 && book.count > 0) {
+        const PriceLevel& level = book.levels[book.count - 1];
+        if (isWorsePrice(book, level.price, order.price)) {
+            break;
+        }
+
+        Order& resting = system.orders.items[level.head];
+        const Order& buyOrder = order.type == Order::Type::BUY ? order : resting;
+        const Order& sellOrder = order.type == Order::Type::SELL ? order : resting;
+        double grnCoins = order.remainingCoins < resting.remainingCoins ? order.remainingCoins : resting.remainingCoins;
+
+        if (getCoins(system, sellOrder.walletId) < grnCoins) {
+            if (resting.type == Order::Type::SELL) {
+                removeBestOrder(system, book, time);
+                continue;
+            }
+            break;
+        }
+        if (system.fills.count == system.fills.capacity && !resizeFillContainer(system.fills)) {
+            break;
+        }
+
+        Fill fill;
+        fill.time = time;
+        fill.orderId = order.id;
+        fill.counterpartyOrderId = resting.id;
+        fill.sellerId = sellOrder.walletId;
+        fill.buyerId = buyOrder.walletId;
+        fill.grnCoins = grnCoins;
+        fill.price = level.price;
+        system.fills.items[system.fills.count++] = fill;
+        recordFill(system, fill);
+        settleFill(system, fill);
+        system.orders.times[level.head] = time;
+        COUNT_EVENT(ORDERS_MATCHED, 1);
+
+        order.remainingCoins -= grnCoins;
+        resting.remainingCoins -= grnCoins;
+        releaseOrder(system, order, grnCoins);
+        releaseOrder(system, resting, grnCoins);
+        if (resting.remainingCoins <= 0) {
+            countExecutedOrder(system, resting);
+            removeBestOrder(system, book, time);
+        }
+    }
+
+    if (order.remainingCoins > 0) {
+        addToBook(system, orderPosition);
+    }
+    else {
+        system.orders.executed[orderPosition] = true;
+        countExecutedOrder(system, order);
+    }
+}
+
+bool canPlaceOrder(System& system, const unsigned walletId, const Order::Type type, const double grnCoins,
+    const double price) {
+    if (findWallet(system, walletId) == nullptr || grnCoins <= 0 || price <= 0) {
+        return false;
+    }
+
+    if (type == Order::Type::BUY) {
+        double usableMoney = buyerUsableMoney(system, walletId);
+        if (usableMoney < grnCoins * price && !isSameBalance(usableMoney, grnCoins * price)) {
+            return false;
+        }
+    }
+    else {
+        double usableCoins = sellerUsableCoins(system, walletId);
+        if (usableCoins < grnCoins && !isSameBalance(usableCoins, grnCoins)) {
+            return false;
+        }
+    }
+    // Matching only removes price levels, so room for one more level lets the order rest without growing the book
+    OrderBook& book = type == Order::Type::BUY ? system.bids : system.asks;
+    return (system.orders.count < system.orders.capacity || resizeOrderContainer(system)) &&
+        (book.count < book.capacity || resizeOrderBook(book));
+}
+
+long long placeOrder(System& system, const unsigned walletId, const Order::Type type, const double grnCoins,
+    const double price, const long long time) {
+    if (!canPlaceOrder(system, walletId, type, grnCoins, price)) {
+        return -1;
+    }
+
+    Order order;
+    order.id = system.orders.nextId++;
+    order.type = type;
+    order.walletId = walletId;
+    order.grnCoins = grnCoins;
+    order.remainingCoins = grnCoins;
+    order.price = price;
+
+    system.orders.items[system.orders.count] = order;
+    system.orders.times[system.orders.count] = time;
+    system.orders.executed[system.orders.count++] = false;
+    reserveOrder(system, order, grnCoins);
+
+    executeOrders(system, system.orders.count - 1, time);
+
+    return order.id;
+}
+
+long long addOrder(System& system, const unsigned walletId, const Order::Type type, const double grnCoins,
+    const double price) {
+    MEASURE_LATENCY(ADD_ORDER);
+    if (!canPlaceOrder(system, walletId, type, grnCoins, price)) {
+        return -1;
+    }
+
+    long long time = getTime();
+    JournalRecord record = makeJournalRecord(JournalRecord::Type::ADD_ORDER, time);
+    record.walletId = walletId;
+    record.orderType = type;
+    record.amount = grnCoins;
+    record.price = price;
+    if (!appendJournalRecord(system.journal, record, "")) {
+        return -1;
+    }
+    return placeOrder(system, walletId, type, grnCoins, price, time);
+}
+
+long long findOrderPosition(const System& system, const unsigned long long orderId) {
+    size_t left = 0, right = system.orders.count;
+    while (left < right) {
+        size_t middle = left + (right - left) / 2;
+        if (system.orders.items[middle].id < orderId) {
+            left = middle + 1;
+        }
+        else {
+            right = middle;
+        }
+    }
+    if (left < system.orders.count && system.orders.items[left].id == orderId) {
+        return left;
+    }
+    return -1;
+}
+
+long long findOpenOrder(const System& system, const unsigned long long orderId) {
+    long long position = findOrderPosition(system, orderId);
+    if (position == -1 || system.orders.executed[position] || system.orders.items[position].remainingCoins <= 0) {
+        return -1;
+    }
+    return position;
+}
+
+bool withdrawOrder(System& system, const unsigned long long orderId, const long long time) {
+    long long position = findOpenOrder(system, orderId);
+    if (position == -1) {
+        return false;
+    }
+
+    Order& order = system.orders.items[position];
+    removeFromBook(system, position);
+    releaseOrder(system, order, order.remainingCoins);
+    order.remainingCoins = 0;
+    system.orders.executed[position] = true;
+    system.orders.times[position] = time;
+    return true;
+}
+
+bool cancelOrder(System& system, const unsigned long long orderId) {
+    long long position = findOpenOrder(system, orderId);
+    if (position == -1) {
+        return false;
+    }
+
+    JournalRecord record = makeJournalRecord(JournalRecord::Type::CANCEL_ORDER, getTime());
+    record.walletId = system.orders.items[position].walletId;
+    record.amount = (double)orderId;
+    return appendJournalRecord(system.journal, record, "") && withdrawOrder(system, orderId, record.time);
+}
+
+size_t replayJournal(System& system, const char filename[], const unsigned long long snapshotSequence) {
+    size_t validSize = 0;
+    std::ifstream journalFile(filename, std::ios::binary);
+    if (!journalFile.is_open()) {
+        return validSize;
+    }
+
+    JournalRecord record;
+    char name[256];
+    while (journalFile.read((char*)&record, sizeof(JournalRecord))) {
+        if (record.nameLength > 255 || !journalFile.read(name, record.nameLength) ||
+            record.checksum != journalChecksum(record, name)) {
+            break;
+        }
+        name[record.nameLength] = '\0';
+        validSize += sizeof(JournalRecord) + record.nameLength;
+        system.journal.sequence = record.sequence;
+        if (record.sequence <= snapshotSequence) {
+            continue;
+        }
+
+        if (record.type == JournalRecord::Type::ADD_WALLET) {
+            createWallet(system, record.walletId, record.amount, name, record.time);
+        }
+        else if (record.type == JournalRecord::Type::TRANSFER) {
+            transferAt(system, record.walletId, record.otherWalletId, record.amount, record.time);
+        }
+        else if (record.type == JournalRecord::Type::ADD_ORDER) {
+            placeOrder(system, record.walletId, record.orderType, record.amount, record.price, record.time);
+        }
+        else if (record.type == JournalRecord::Type::CANCEL_ORDER) {
+            withdrawOrder(system, (unsigned long long)record.amount, record.time);
+        }
+        else if (record.type == JournalRecord::Type::TRANSFER_BATCH) {
+            size_t count = (size_t)record.amount;
+            TransferRequest* transfers = new (std::nothrow) TransferRequest[count > 0 ? count : 1];
+            size_t received = 0;
+            JournalRecord transferRecord;
+            while (transfers != nullptr && received < count &&
+                journalFile.read((char*)&transferRecord, sizeof(JournalRecord)) &&
+                transferRecord.type == JournalRecord::Type::TRANSFER && transferRecord.nameLength == 0 &&
+                transferRecord.sequence == record.sequence + received + 1 &&
+                transferRecord.checksum == journalChecksum(transferRecord, "")) {
+                transfers[received++] = { transferRecord.walletId, transferRecord.otherWalletId, transferRecord.amount };
+            }
+            // A batch cut short by a crash is dropped whole, and the journal is truncated before its header
+            if (received < count) {
+                validSize -= sizeof(JournalRecord);
+                system.journal.sequence = record.sequence - 1;
+                delete[] transfers;
+                break;
+            }
+            validSize += count * sizeof(JournalRecord);
+            system.journal.sequence = record.sequence + count;
+            transferBatchAt(system, transfers, count, record.time);
+            delete[] transfers;
+        }
+    }
+    journalFile.close();
+    return validSize;
+}
+
+void openJournal(System& system, const unsigned long long snapshotSequence) {
+    system.journal.sequence = snapshotSequence;
+    system.journal.pendingRecords = 0;
+    system.journal.firstPendingTime = 0;
+    system.journal.groupCommitCount = GROUP_COMMIT_COUNT;
+    system.journal.groupCommitWindow = GROUP_COMMIT_WINDOW;
+    system.journal.flushEachRecord = true;
+    system.journal.deferCommit = false;
+    system.journal.failed = false;
+    system.journal.stopping = false;
+    system.journal.file = nullptr;
+
+    replayJournal(system, PREVIOUS_JOURNAL_FILENAME, snapshotSequence);
+    size_t validSize = replayJournal(system, JOURNAL_FILENAME, snapshotSequence);
+    if (system.journal.sequence < snapshotSequence) {
+        system.journal.sequence = snapshotSequence;
+    }
+    system.journal.syncedSequence = system.journal.sequence;
+    std::error_code error;
+    std::filesystem::resize_file(JOURNAL_FILENAME, validSize, error);
+    system.journal.file = fopen(JOURNAL_FILENAME, "ab");
+    if (system.journal.file == nullptr) {
+        std::cout << "Could not open " << JOURNAL_FILENAME << ", rejecting changes" << std::endl;
+    }
+}
+
+void* mapFile(const char filename[], size_t& size) {
+    void* view = nullptr;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            size = (size_t)fileSize.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int file = open(filename, O_RDONLY);
+    if (file == -1) {
+        return nullptr;
+    }
+    struct stat fileStat;
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0) {
+        view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED) {
+            view = nullptr;
+        }
+        size = fileStat.st_size;
+    }
+    close(file);
+#endif
+    return view;
+}
+
+void unmapFile(void* view, const size_t size) {
+    if (view == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+}
+
+size_t ledgerFileSize(const size_t count) {
+    size_t fullBlocks = count / LEDGER_BLOCK_SIZE;
+    size_t lastBlockCount = count % LEDGER_BLOCK_SIZE;
+    size_t size = sizeof(LedgerHeader) + fullBlocks * LEDGER_BLOCK_SIZE * sizeof(Transaction);
+    if (lastBlockCount > 0) {
+        size += LEDGER_BLOCK_SIZE * (sizeof(Transaction) - sizeof(double)) + lastBlockCount * sizeof(double);
+    }
+    return size;
+}
+
+bool isValidLedgerHeader(const LedgerHeader& header, const size_t fileSize) {
+    if (memcmp(header.magic, LEDGER_MAGIC, sizeof(LEDGER_MAGIC)) != 0 || header.recordSize != sizeof(Transaction)) {
+        return false;
+    }
+    if (header.version == LEGACY_LEDGER_VERSION) {
+        size_t legacyHeaderSize = sizeof(LedgerHeader) - sizeof(header.blockSize);
+        return header.count <= (fileSize - legacyHeaderSize) / sizeof(Transaction);
+    }
+    return header.version == LEDGER_VERSION && header.blockSize == LEDGER_BLOCK_SIZE &&
+        ledgerFileSize(header.count) <= fileSize;
+}
+
+void loadTransactions(TransactionContainer& transactions, const SnapshotHeader& snapshot) {
+    transactions.history = nullptr;
+    transactions.historyCount = 0;
+    transactions.persistedCount = 0;
+    transactions.checksum = LEDGER_CHECKSUM_SEED;
+    transactions.mappedSize = 0;
+    transactions.mappedView = mapFile(TRANSACTIONS_FILENAME, transactions.mappedSize);
+    transactions.capacity = 0;
+    transactions.count = 0;
+    initChunkedArray(transactions.times);
+    initChunkedArray(transactions.senderIds);
+    initChunkedArray(transactions.receiverIds);
+    initChunkedArray(transactions.grnCoins);
+
+    const LedgerHeader* header = (const LedgerHeader*)transactions.mappedView;
+    bool valid = transactions.mappedView != nullptr && transactions.mappedSize >= sizeof(LedgerHeader) &&
+        isValidLedgerHeader(*header, transactions.mappedSize);
+
+    // Records past the count in snapshot.dat were written by a checkpoint that did not complete
+    size_t count = valid && snapshot.ledgerCount < header->count ? snapshot.ledgerCount : (valid ? header->count : 0);
+    if (valid && header->version == LEDGER_VERSION) {
+        transactions.history = (const char*)transactions.mappedView + sizeof(LedgerHeader);
+        transactions.historyCount = count;
+        transactions.persistedCount = count;
+        transactions.checksum = count < header->count ? snapshot.ledgerChecksum : header->checksum;
+        std::cout << transactions.historyCount << std::endl;
+        return;
+    }
+
+    if (valid) {
+        const Transaction* records = (const Transaction*)((const char*)transactions.mappedView +
+            sizeof(LedgerHeader) - sizeof(header->blockSize));
+        while (transactions.capacity < count) {
+            resizeTransactionContainer(transactions);
+        }
+        for (size_t i = 0; i < count; i++) {
+            transactions.times[i] = records[i].time;
+            transactions.senderIds[i] = records[i].senderId;
+            transactions.receiverIds[i] = records[i].receiverId;
+            transactions.grnCoins[i] = records[i].grnCoins;
+        }
+        transactions.count = count;
+        std::cout << transactions.count << std::endl;
+    }
+    else if (transactions.mappedView != nullptr) {
+        std::cout << "Unsupported format of " << TRANSACTIONS_FILENAME << ", ignoring its contents" << std::endl;
+    }
+    unmapFile(transactions.mappedView, transactions.mappedSize);
+    transactions.mappedView = nullptr;
+    transactions.mappedSize = 0;
+}
+
+template <typename T>
+void writeLedgerColumn(std::ostream& file, const size_t offset, const Transaction* records, const size_t count,
+    T Transaction::* field) {
+    T values[LEDGER_BLOCK_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        values[i] = records[i].*field;
+    }
+    file.seekp(offset);
+    file.write((const char*)values, count * sizeof(T));
+}
+
+void writeLedgerRecords(std::ostream& file, size_t position, const Transaction* records, const size_t count) {
+    size_t written = 0;
+    while (written < count) {
+        size_t slot = position % LEDGER_BLOCK_SIZE;
+        size_t run = LEDGER_BLOCK_SIZE - slot < count - written ? LEDGER_BLOCK_SIZE - slot : count - written;
+        size_t block = sizeof(LedgerHeader) + position / LEDGER_BLOCK_SIZE * LEDGER_BLOCK_SIZE * sizeof(Transaction);
+        writeLedgerColumn(file, block + slot * sizeof(long long),
+            records + written, run, &Transaction::time);
+        writeLedgerColumn(file, block + LEDGER_BLOCK_SIZE * sizeof(long long) + slot * sizeof(unsigned),
+            records + written, run, &Transaction::senderId);
+        writeLedgerColumn(file, block + LEDGER_BLOCK_SIZE * (sizeof(long long) + sizeof(unsigned)) + slot * sizeof(unsigned),
+            records + written, run, &Transaction::receiverId);
+        writeLedgerColumn(file, block + LEDGER_BLOCK_SIZE * (sizeof(long long) + 2 * sizeof(unsigned)) + slot * sizeof(double),
+            records + written, run, &Transaction::grnCoins);
+        position += run;
+        written += run;
+    }
+}
+
+bool writeTemporaryFile(const char filename[], const FileSection sections[], const size_t sectionCount) {
+    char temporaryFilename[MAX_INPUT_LENGTH];
+    strcpy(temporaryFilename, filename);
+    strcat(temporaryFilename, ".tmp");
+
+    std::ofstream file(temporaryFilename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    for (size_t i = 0; i < sectionCount; i++) {
+        file.write((const char*)sections[i].data, sections[i].size);
+    }
+    file.close();
+    return (bool)file;
+}
+
+bool writeTemporaryFile(const char filename[], const void* header, const size_t headerSize,
+    const void* data, const size_t dataSize, const void* trailer = nullptr, const size_t trailerSize = 0) {
+    FileSection sections[3] = { { header, headerSize }, { data, dataSize }, { trailer, trailerSize } };
+    return writeTemporaryFile(filename, sections, 3);
+}
+
+bool commitTemporaryFile(const char filename[]) {
+    char temporaryFilename[MAX_INPUT_LENGTH];
+    strcpy(temporaryFilename, filename);
+    strcat(temporaryFilename, ".tmp");
+
+    std::error_code error;
+    std::filesystem::rename(temporaryFilename, filename, error);
+    return !error;
+}
+
+bool writeFileAtomically(const char filename[], const void* header, const size_t headerSize,
+    const void* data, const size_t dataSize, const void* trailer = nullptr, const size_t trailerSize = 0) {
+    return writeTemporaryFile(filename, header, headerSize, data, dataSize, trailer, trailerSize) &&
+        commitTemporaryFile(filename);
+}
+
+bool saveLedger(Checkpoint& checkpoint) {
+    LedgerHeader header;
+    memset(&header, 0, sizeof(LedgerHeader));
+    memcpy(header.magic, LEDGER_MAGIC, sizeof(LEDGER_MAGIC));
+    header.version = LEDGER_VERSION;
+    header.recordSize = sizeof(Transaction);
+    header.blockSize = LEDGER_BLOCK_SIZE;
+    header.count = checkpoint.persistedCount + checkpoint.unsavedCount;
+    header.checksum = ledgerChecksum(checkpoint.checksum, checkpoint.unsaved, checkpoint.unsavedCount);
+
+    char temporaryFilename[MAX_INPUT_LENGTH];
+    strcpy(temporaryFilename, TRANSACTIONS_FILENAME);
+    strcat(temporaryFilename, ".tmp");
+    const char* filename = checkpoint.persistedCount == 0 ? temporaryFilename : TRANSACTIONS_FILENAME;
+    std::ios::openmode mode = std::ios::binary | std::ios::out;
+    if (checkpoint.persistedCount > 0) {
+        mode |= std::ios::in;
+    }
+
+    std::fstream transactionsFile(filename, mode);
+    if (!transactionsFile.is_open()) {
+        return false;
+    }
+    writeLedgerRecords(transactionsFile, checkpoint.persistedCount, checkpoint.unsaved, checkpoint.unsavedCount);
+    transactionsFile.flush();
+    transactionsFile.seekp(0);
+    transactionsFile.write((const char*)&header, sizeof(LedgerHeader));
+    transactionsFile.close();
+    if (!transactionsFile) {
+        return false;
+    }
+
+    if (checkpoint.persistedCount == 0) {
+        std::error_code error;
+        std::filesystem::rename(temporaryFilename, TRANSACTIONS_FILENAME, error);
+        if (error) {
+            return false;
+        }
+    }
+    checkpoint.persistedCount = header.count;
+    checkpoint.checksum = header.checksum;
+    return true;
+}
+
+bool saveFills(Checkpoint& checkpoint) {
+    if (checkpoint.persistedFills == 0) {
+        if (!writeFileAtomically(FILLS_FILENAME, nullptr, 0, checkpoint.fills, checkpoint.fillCount * sizeof(Fill))) {
+            return false;
+        }
+    }
+    else {
+        std::fstream fillsFile(FILLS_FILENAME, std::ios::binary | std::ios::in | std::ios::out);
+        if (!fillsFile.is_open()) {
+            return false;
+        }
+        fillsFile.seekp(checkpoint.persistedFills * sizeof(Fill));
+        fillsFile.write((const char*)checkpoint.fills, checkpoint.fillCount * sizeof(Fill));
+        fillsFile.close();
+        std::error_code error;
+        std::filesystem::resize_file(FILLS_FILENAME, (checkpoint.persistedFills + checkpoint.fillCount) * sizeof(Fill), error);
+        if (!fillsFile || error) {
+            return false;
+        }
+    }
+    checkpoint.persistedFills += checkpoint.fillCount;
+    return true;
+}
+
+bool writeSnapshot(const SnapshotHeader& snapshot) {
+    return writeFileAtomically(SNAPSHOT_FILENAME, nullptr, 0, &snapshot, sizeof(SnapshotHeader));
+}
+
+// Renaming snapshot.dat.tmp commits a checkpoint; the other files are staged before it and renamed after it
+bool commitCheckpointFiles() {
+    bool committed = commitTemporaryFile(SNAPSHOT_FILENAME);
+    for (size_t i = 0; committed && i < CHECKPOINT_FILE_COUNT; i++) {
+        committed = commitTemporaryFile(CHECKPOINT_FILENAMES[i]);
+    }
+    return committed;
+}
+
+void recoverCheckpointFiles() {
+    char temporaryFilename[MAX_INPUT_LENGTH];
+    strcpy(temporaryFilename, SNAPSHOT_FILENAME);
+    strcat(temporaryFilename, ".tmp");
+    std::error_code error;
+    bool committed = !std::filesystem::exists(temporaryFilename, error);
+    std::filesystem::remove(temporaryFilename, error);
+    for (size_t i = 0; i < CHECKPOINT_FILE_COUNT; i++) {
+        strcpy(temporaryFilename, CHECKPOINT_FILENAMES[i]);
+        strcat(temporaryFilename, ".tmp");
+        if (committed && std::filesystem::exists(temporaryFilename, error)) {
+            commitTemporaryFile(CHECKPOINT_FILENAMES[i]);
+        }
+        else {
+            std::filesystem::remove(temporaryFilename, error);
+        }
+    }
+}
+
+SnapshotHeader readSnapshot() {
+    SnapshotHeader snapshot = { 0, UNBOUNDED_COUNT, 0, UNBOUNDED_COUNT };
+    std::ifstream snapshotFile(SNAPSHOT_FILENAME, std::ios::binary);
+    if (snapshotFile.is_open()) {
+        snapshotFile.read((char*)&snapshot, sizeof(SnapshotHeader));
+        // Older snapshots hold only the journal sequence
+        if ((size_t)snapshotFile.gcount() < sizeof(SnapshotHeader)) {
+            snapshot.ledgerCount = UNBOUNDED_COUNT;
+            snapshot.fillCount = UNBOUNDED_COUNT;
+        }
+        snapshotFile.close();
+    }
+    return snapshot;
+}
+
+void writeCheckpoint(Checkpoint& checkpoint) {
+    unsigned long long balancesHeader[2] = { checkpoint.ledgerSize, checkpoint.walletCount };
+    WalletsHeader walletsHeader;
+    memset(&walletsHeader, 0, sizeof(WalletsHeader));
+    memcpy(walletsHeader.magic, WALLETS_MAGIC, sizeof(WALLETS_MAGIC));
+    walletsHeader.version = WALLETS_VERSION;
+    walletsHeader.recordSize = sizeof(Wallet);
+    walletsHeader.count = checkpoint.walletCount;
+    walletsHeader.namesSize = checkpoint.ownersSize;
+    OrdersHeader ordersHeader;
+    memset(&ordersHeader, 0, sizeof(OrdersHeader));
+    memcpy(ordersHeader.magic, ORDERS_MAGIC, sizeof(ORDERS_MAGIC));
+    ordersHeader.version = ORDERS_VERSION;
+    ordersHeader.recordSize = sizeof(Order);
+    ordersHeader.count = checkpoint.orderCount;
+    ordersHeader.nextId = checkpoint.nextOrderId;
+    FileSection ordersSections[4] = { { &ordersHeader, sizeof(OrdersHeader) },
+        { checkpoint.orders, checkpoint.orderCount * sizeof(Order) },
+        { checkpoint.executed, checkpoint.orderCount * sizeof(bool) },
+        { checkpoint.orderTimes, checkpoint.orderCount * sizeof(long long) } };
+    bool appended = saveLedger(checkpoint) && saveFills(checkpoint);
+    SnapshotHeader snapshot = { checkpoint.sequence, checkpoint.persistedCount, checkpoint.checksum, checkpoint.persistedFills };
+    checkpoint.successful = appended &&
+        writeTemporaryFile(SNAPSHOT_FILENAME, nullptr, 0, &snapshot, sizeof(SnapshotHeader)) &&
+        writeTemporaryFile(WALLETS_FILENAME, &walletsHeader, sizeof(WalletsHeader),
+            checkpoint.wallets, checkpoint.walletCount * sizeof(Wallet), checkpoint.owners, checkpoint.ownersSize) &&
+        writeTemporaryFile(EXECUTED_ORDERS_FILENAME, nullptr, 0,
+            checkpoint.executedOrders, checkpoint.walletCount * sizeof(size_t)) &&
+        writeTemporaryFile(BALANCES_FILENAME, balancesHeader, sizeof(balancesHeader),
+            checkpoint.coins, checkpoint.walletCount * sizeof(double)) &&
+        writeTemporaryFile(ORDERS_FILENAME, ordersSections, 4) &&
+        commitCheckpointFiles();
+
+    if (checkpoint.successful) {
+        std::error_code error;
+        std::filesystem::remove(PREVIOUS_JOURNAL_FILENAME, error);
+    }
+    checkpoint.finished = true;
+}
+
+template <typename T>
+T* copyItems(const T* items, const size_t count) {
+    T* copy = new (std::nothrow) T[count > 0 ? count : 1];
+    for (size_t i = 0; i < count; i++) {
+        copy[i] = items[i];
+    }
+    return copy;
+}
+
+template <typename T>
+T* copyItems(const ChunkedArray<T>& items, const size_t first, const size_t count) {
+    T* copy = new (std::nothrow) T[count > 0 ? count : 1];
+    if (copy == nullptr) {
+        return nullptr;
+    }
+    for (size_t copied = 0; copied < count; ) {
+        size_t position = first + copied;
+        size_t run = CHUNK_SIZE - position % CHUNK_SIZE < count - copied ? CHUNK_SIZE - position % CHUNK_SIZE : count - copied;
+        memcpy(copy + copied, &items[position], run * sizeof(T));
+        copied += run;
+    }
+    return copy;
+}
+
+template <typename T>
+T* copyItems(const ChunkedArray<T>& items, const size_t count) {
+    return copyItems(items, 0, count);
+}
+
+void takeSnapshot(System& system) {
+    Checkpoint& checkpoint = system.checkpoint;
+    TransactionContainer& transactions = system.transactions;
+
+    syncJournal(system.journal);
+    std::error_code error;
+    {
+        std::lock_guard<std::mutex> syncLock(system.journal.syncMutex);
+        std::lock_guard<std::mutex> lock(system.journal.mutex);
+        if (system.journal.file != nullptr && !std::filesystem::exists(PREVIOUS_JOURNAL_FILENAME, error)) {
+            fclose(system.journal.file);
+            std::filesystem::rename(JOURNAL_FILENAME, PREVIOUS_JOURNAL_FILENAME, error);
+            system.journal.file = fopen(JOURNAL_FILENAME, "ab");
+            if (system.journal.file == nullptr) {
+                failJournal(system.journal);
+            }
+        }
+    }
+
+    checkpoint.sequence = system.journal.sequence;
+    checkpoint.wallets = copyItems(system.wallets.items, system.wallets.count);
+    checkpoint.executedOrders = copyItems(system.wallets.executedOrders, system.wallets.count);
+    checkpoint.coins = copyItems(system.wallets.coins, system.wallets.count);
+    checkpoint.walletCount = system.wallets.count;
+    checkpoint.owners = copyItems(system.wallets.owners.items, system.wallets.owners.count);
+    checkpoint.ownersSize = system.wallets.owners.count;
+    checkpoint.orders = copyItems(system.orders.items, system.orders.count);
+    checkpoint.executed = copyItems(system.orders.executed, system.orders.count);
+    checkpoint.orderTimes = copyItems(system.orders.times, system.orders.count);
+    checkpoint.orderCount = system.orders.count;
+    checkpoint.nextOrderId = system.orders.nextId;
+    checkpoint.fills = copyItems(system.fills.items, system.fills.persistedCount, system.fills.count - system.fills.persistedCount);
+    checkpoint.fillCount = system.fills.count - system.fills.persistedCount;
+    checkpoint.persistedFills = system.fills.persistedCount;
+
+    checkpoint.unsavedCount = ledgerSize(transactions) - transactions.persistedCount;
+    checkpoint.unsaved = new (std::nothrow) Transaction[checkpoint.unsavedCount > 0 ? checkpoint.unsavedCount : 1];
+    for (size_t i = 0; i < checkpoint.unsavedCount; i++) {
+        checkpoint.unsaved[i] = getTransaction(transactions, transactions.persistedCount + i);
+    }
+    checkpoint.ledgerSize = ledgerSize(transactions);
+    checkpoint.persistedCount = transactions.persistedCount;
+    checkpoint.checksum = transactions.checksum;
+
+    checkpoint.lastTime = getTime();
+    checkpoint.finished = false;
+    checkpoint.active = true;
+}
+
+bool finishCheckpoint(System& system) {
+    Checkpoint& checkpoint = system.checkpoint;
+    if (checkpoint.writer.joinable()) {
+        checkpoint.writer.join();
+    }
+    if (!checkpoint.active) {
+        return true;
+    }
+
+    if (checkpoint.successful) {
+        system.transactions.persistedCount = checkpoint.persistedCount;
+        system.transactions.checksum = checkpoint.checksum;
+        system.fills.persistedCount = checkpoint.persistedFills;
+    }
+    delete[] checkpoint.wallets;
+    delete[] checkpoint.executedOrders;
+    delete[] checkpoint.coins;
+    delete[] checkpoint.owners;
+    delete[] checkpoint.orders;
+    delete[] checkpoint.executed;
+    delete[] checkpoint.orderTimes;
+    delete[] checkpoint.fills;
+    delete[] checkpoint.unsaved;
+    checkpoint.active = false;
+    return checkpoint.successful;
+}
+
+bool startCheckpoint(System& system) {
+    if (system.checkpoint.active && !system.checkpoint.finished) {
+        return false;
+    }
+    if (!finishCheckpoint(system)) {
+        std::cout << "Could not save checkpoint" << std::endl;
+    }
+    takeSnapshot(system);
+    system.checkpoint.writer = std::thread(writeCheckpoint, std::ref(system.checkpoint));
+    return true;
+}
+
+void checkpointIfDue(System& system) {
+    if (system.checkpoint.active && system.checkpoint.finished && !finishCheckpoint(system)) {
+        std::cout << "Could not save checkpoint" << std::endl;
+    }
+    if (system.checkpoint.interval > 0 && getTime() - system.checkpoint.lastTime >= system.checkpoint.interval) {
+        startCheckpoint(system);
+    }
+}
+
+bool saveSystem(System& system) {
+    finishCheckpoint(system);
+    takeSnapshot(system);
+    writeCheckpoint(system.checkpoint);
+    return finishCheckpoint(system);
+}
+
+bool quit(System& system) {
+    MEASURE_LATENCY(QUIT);
+    return saveSystem(system);
+}
+
+bool releaseSystem(System& system) {
+    finishCheckpoint(system);
+    bool synced = closeJournal(system.journal);
+
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        delete[] system.wallets.histories[i].positions;
+    }
+    delete[] system.wallets.items;
+    delete[] system.wallets.executedOrders;
+    delete[] system.wallets.coins;
+    delete[] system.wallets.reservedFiat;
+    delete[] system.wallets.reservedCoins;
+    delete[] system.wallets.histories;
+    delete[] system.wallets.volumes;
+    delete[] system.wallets.index;
+    delete[] system.wallets.owners.items;
+    delete[] system.wallets.owners.index;
+    system.wallets.count = 0;
+    system.wallets.capacity = 0;
+
+    unmapFile(system.transactions.mappedView, system.transactions.mappedSize);
+    releaseChunkedArray(system.transactions.times);
+    releaseChunkedArray(system.transactions.senderIds);
+    releaseChunkedArray(system.transactions.receiverIds);
+    releaseChunkedArray(system.transactions.grnCoins);
+    system.transactions.count = 0;
+    system.transactions.capacity = 0;
+
+    releaseChunkedArray(system.orders.items);
+    releaseChunkedArray(system.orders.executed);
+    releaseChunkedArray(system.orders.times);
+    releaseChunkedArray(system.orders.next);
+    releaseChunkedArray(system.orders.previous);
+    system.orders.count = 0;
+    system.orders.capacity = 0;
+    delete[] system.bids.levels;
+    delete[] system.asks.levels;
+    releaseChunkedArray(system.fills.items);
+    system.fills.count = 0;
+    system.fills.capacity = 0;
+    for (size_t i = 0; i < MARKET_INTERVAL_COUNT; i++) {
+        delete[] system.market.series[i].bars;
+    }
+    return synced;
+}
+
+template <typename T, typename IsStale>
+bool appendArchiveSegment(const char filename[], ArchiveHeader& header, const T* records,
+    const CarryForward* carryForwards, IsStale isStale) {
+    size_t carryForwardCount;
+    size_t validSize = findArchiveEnd<T>(filename, isStale, carryForwardCount);
+    std::error_code error;
+    std::filesystem::resize_file(filename, validSize, error);
+
+    FILE* file = fopen(filename, "ab");
+    if (file == nullptr) {
+        return false;
+    }
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.recordSize = sizeof(T);
+    header.checksum = bytesChecksum(bytesChecksum(LEDGER_CHECKSUM_SEED, records, header.count * sizeof(T)),
+        carryForwards, header.carryForwardCount * sizeof(CarryForward));
+    bool written = fwrite(&header, sizeof(ArchiveHeader), 1, file) == 1 &&
+        fwrite(records, sizeof(T), header.count, file) == header.count &&
+        (carryForwards == nullptr ||
+            fwrite(carryForwards, sizeof(CarryForward), header.carryForwardCount, file) == header.carryForwardCount) &&
+        fflush(file) == 0;
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+    return fclose(file) == 0 && written;
+}
+
+bool compactOrders(System& system, const long long watermark, size_t& archived) {
+    OrdersContainer& orders = system.orders;
+    size_t count = 0;
+    for (size_t i = 0; i < orders.count; i++) {
+        if (orders.executed[i] && orders.times[i] < watermark) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return true;
+    }
+
+    Order* executedOrders = new (std::nothrow) Order[count];
+    if (executedOrders == nullptr) {
+        return false;
+    }
+    for (size_t i = 0, position = 0; i < orders.count; i++) {
+        if (orders.executed[i] && orders.times[i] < watermark) {
+            executedOrders[position++] = orders.items[i];
+        }
+    }
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(ArchiveHeader));
+    header.count = count;
+    header.watermark = watermark;
+    bool appended = appendArchiveSegment(ORDERS_ARCHIVE_FILENAME, header, executedOrders, (const CarryForward*)nullptr,
+        [&](const Order& first, size_t) { return findOrderPosition(system, first.id) != -1; });
+    delete[] executedOrders;
+    if (!appended) {
+        return false;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < orders.count; i++) {
+        if (!orders.executed[i] || orders.times[i] >= watermark) {
+            orders.items[kept] = orders.items[i];
+            orders.executed[kept] = orders.executed[i];
+            orders.times[kept++] = orders.times[i];
+        }
+    }
+    orders.count = kept;
+    truncateChunkedArray(orders.items, kept);
+    truncateChunkedArray(orders.executed, kept);
+    truncateChunkedArray(orders.times, kept);
+    truncateChunkedArray(orders.next, kept);
+    truncateChunkedArray(orders.previous, kept);
+    orders.capacity = orders.items.chunkCount * CHUNK_SIZE;
+    archived = count;
+    return rebuildOrderBooks(system);
+}
+
+bool compactLedger(System& system, const long long watermark, size_t& archived) {
+    TransactionContainer& transactions = system.transactions;
+    auto isStale = [&](const Transaction& first, const size_t previousCarryForwards) {
+        return isLiveLedgerRecord(transactions, first, previousCarryForwards);
+    };
+    size_t total = ledgerSize(transactions);
+    size_t carriedForward = 0;
+    findArchiveEnd<Transaction>(TRANSACTIONS_ARCHIVE_FILENAME, isStale, carriedForward);
+    size_t count = 0;
+    while (count < total && getTransaction(transactions, count).time < watermark) {
+        count++;
+    }
+    // The carry-forwards of the previous compaction are folded into the new ones instead of being archived again
+    if (count <= carriedForward) {
+        return true;
+    }
+
+    Transaction* archivedTransactions = new (std::nothrow) Transaction[count - carriedForward];
+    double* balances = new (std::nothrow) double[system.wallets.count > 0 ? system.wallets.count : 1];
+    CarryForward* carryForwards = new (std::nothrow) CarryForward[system.wallets.count > 0 ? system.wallets.count : 1];
+    TransactionContainer compacted;
+    compacted.history = nullptr;
+    compacted.historyCount = 0;
+    compacted.mappedView = nullptr;
+    compacted.mappedSize = 0;
+    compacted.persistedCount = 0;
+    compacted.checksum = LEDGER_CHECKSUM_SEED;
+    compacted.count = 0;
+    compacted.capacity = 0;
+    initChunkedArray(compacted.times);
+    initChunkedArray(compacted.senderIds);
+    initChunkedArray(compacted.receiverIds);
+    initChunkedArray(compacted.grnCoins);
+
+    bool successful = archivedTransactions != nullptr && balances != nullptr && carryForwards != nullptr;
+    size_t carryForwardCount = 0;
+    if (successful) {
+        for (size_t i = 0; i < system.wallets.count; i++) {
+            balances[i] = 0;
+        }
+        for (size_t i = 0; i < count; i++) {
+            Transaction transaction = getTransaction(transactions, i);
+            applyTransaction(system, balances, transaction);
+            if (i >= carriedForward) {
+                archivedTransactions[i - carriedForward] = transaction;
+            }
+        }
+        for (size_t i = 0; i < system.wallets.count; i++) {
+            if (balances[i] != 0) {
+                carryForwards[carryForwardCount++] = { system.wallets.items[i].id, balances[i] };
+            }
+        }
+        while (successful && compacted.capacity < carryForwardCount + total - count) {
+            successful = resizeTransactionContainer(compacted);
+        }
+    }
+    if (successful) {
+        ArchiveHeader header;
+        memset(&header, 0, sizeof(ArchiveHeader));
+        header.count = count - carriedForward;
+        header.carryForwardCount = carryForwardCount;
+        header.watermark = watermark;
+        successful = appendArchiveSegment(TRANSACTIONS_ARCHIVE_FILENAME, header, archivedTransactions, carryForwards, isStale);
+    }
+    if (successful) {
+        // Stamped with the last archived time, which precedes the watermark and every live record
+        for (size_t i = 0; i < carryForwardCount; i++) {
+            compacted.times[compacted.count] = archivedTransactions[count - carriedForward - 1].time;
+            compacted.senderIds[compacted.count] = (unsigned)SYSTEM_WALLET_ID;
+            compacted.receiverIds[compacted.count] = carryForwards[i].walletId;
+            compacted.grnCoins[compacted.count++] = carryForwards[i].grnCoins;
+        }
+        for (size_t i = count; i < total; i++) {
+            Transaction transaction = getTransaction(transactions, i);
+            compacted.times[compacted.count] = transaction.time;
+            compacted.senderIds[compacted.count] = transaction.senderId;
+            compacted.receiverIds[compacted.count] = transaction.receiverId;
+            compacted.grnCoins[compacted.count++] = transaction.grnCoins;
+        }
+        std::swap(transactions, compacted);
+        for (size_t i = 0; i < system.wallets.count; i++) {
+            system.wallets.histories[i].count = 0;
+        }
+        system.wallets.historiesIndexed = false;
+        system.wallets.archiveIndexed = false;
+        archived = count - carriedForward;
+    }
+
+    releaseChunkedArray(compacted.times);
+    releaseChunkedArray(compacted.senderIds);
+    releaseChunkedArray(compacted.receiverIds);
+    releaseChunkedArray(compacted.grnCoins);
+    unmapFile(compacted.mappedView, compacted.mappedSize);
+    delete[] archivedTransactions;
+    delete[] balances;
+    delete[] carryForwards;
+    return successful;
+}
+
+bool isLiveFill(const System& system, const Fill& fill) {
+    for (size_t i = 0; i < system.fills.count; i++) {
+        const Fill& live = system.fills.items[i];
+        if (live.orderId == fill.orderId && live.counterpartyOrderId == fill.counterpartyOrderId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isArchivedFill(const System& system, const Fill& fill) {
+    return findOrderPosition(system, fill.orderId) == -1 && findOrderPosition(system, fill.counterpartyOrderId) == -1;
+}
+
+// Runs after compactOrders, archiving the fills whose orders have both been archived
+bool compactFills(System& system, const long long watermark, size_t& archived) {
+    FillContainer& fills = system.fills;
+    size_t count = 0;
+    for (size_t i = 0; i < fills.count; i++) {
+        if (isArchivedFill(system, fills.items[i])) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return true;
+    }
+
+    Fill* archivedFills = new (std::nothrow) Fill[count];
+    if (archivedFills == nullptr) {
+        return false;
+    }
+    for (size_t i = 0, position = 0; i < fills.count; i++) {
+        if (isArchivedFill(system, fills.items[i])) {
+            archivedFills[position++] = fills.items[i];
+        }
+    }
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(ArchiveHeader));
+    header.count = count;
+    header.watermark = watermark;
+    bool appended = appendArchiveSegment(FILLS_ARCHIVE_FILENAME, header, archivedFills, (const CarryForward*)nullptr,
+        [&](const Fill& first, size_t) { return isLiveFill(system, first); });
+    delete[] archivedFills;
+    if (!appended) {
+        return false;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < fills.count; i++) {
+        if (!isArchivedFill(system, fills.items[i])) {
+            fills.items[kept++] = fills.items[i];
+        }
+    }
+    fills.count = kept;
+    truncateChunkedArray(fills.items, kept);
+    fills.capacity = fills.items.chunkCount * CHUNK_SIZE;
+    // fills.dat shrinks, so the next checkpoint rewrites it instead of appending
+    fills.persistedCount = 0;
+    archived = count;
+    return true;
+}
+
+void rebuildMarketData(System& system) {
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        system.wallets.volumes[i] = { 0, 0, 0, 0 };
+    }
+    bool complete = readArchive<Fill>(FILLS_ARCHIVE_FILENAME, [&](const Fill& first, size_t) { return isLiveFill(system, first); },
+        [&](const Fill& fill) { recordFill(system, fill); });
+    if (!complete) {
+        std::cout << "Could not read " << FILLS_ARCHIVE_FILENAME << ", market data covers live fills only" << std::endl;
+    }
+    for (size_t i = 0; i < system.fills.count; i++) {
+        recordFill(system, system.fills.items[i]);
+    }
+}
+
+long long newestLedgerTime(const System& system) {
+    size_t total = ledgerSize(system.transactions);
+    return total > 0 ? getTransaction(system.transactions, total - 1).time : -1;
+}
+
+bool compactSystem(System& system, const long long watermark, size_t& archivedOrders, size_t& archivedFills,
+    size_t& archivedTransactions) {
+    archivedOrders = 0;
+    archivedFills = 0;
+    archivedTransactions = 0;
+    // Compaction rewrites transactions.dat, so until the final snapshot the ledger on disk is trusted as a whole
+    return saveSystem(system) &&
+        writeSnapshot({ system.journal.sequence, UNBOUNDED_COUNT, 0, UNBOUNDED_COUNT }) &&
+        compactOrders(system, watermark, archivedOrders) && compactFills(system, watermark, archivedFills) &&
+        compactLedger(system, watermark, archivedTransactions) && saveSystem(system);
+}
+
+void loadSystem(System& system, const StartupOptions& options) {
+    MEASURE_LATENCY(LOAD_SYSTEM);
+    long long startTime = getMicroseconds();
+    recoverCheckpointFiles();
+    system.wallets.capacity = INITIAL_CAPACITY;
+    system.wallets.count = 0;
+    system.wallets.owners.capacity = MAX_INPUT_LENGTH;
+    system.wallets.owners.count = 0;
+    system.wallets.owners.names = 0;
+    system.wallets.owners.index = nullptr;
+
     std::ifstream walletsFile(WALLETS_FILENAME, std::ios::binary);
     if (walletsFile.is_open()) {
         size_t fileSize = getFileSize(walletsFile);
-        system.wallets.count = fileSize / sizeof(Wallet);
-        system.wallets.capacity = system.wallets.count;
+        WalletsHeader header;
+        memset(&header, 0, sizeof(WalletsHeader));
+        walletsFile.read((char*)&header, sizeof(WalletsHeader));
+        if (walletsFile && memcmp(header.magic, WALLETS_MAGIC, sizeof(WALLETS_MAGIC)) == 0 &&
+            header.version == WALLETS_VERSION && header.recordSize == sizeof(Wallet) &&
+            sizeof(WalletsHeader) + header.count * sizeof(Wallet) + header.namesSize == fileSize) {
+            system.wallets.count = header.count;
+            system.wallets.owners.count = header.namesSize;
+        }
+        else {
+            std::cout << "Unsupported format of " << WALLETS_FILENAME << ", ignoring its contents" << std::endl;
+        }
         std::cout << system.wallets.count << std::endl;
-        system.wallets.items = new (std::nothrow) Wallet[system.wallets.capacity];
-        walletsFile.read((char*)&system.wallets.items, system.wallets.count * sizeof(Wallet));
+    }
+    while (system.wallets.capacity < system.wallets.count) {
+        system.wallets.capacity *= 2;
+    }
+    while (system.wallets.owners.capacity < system.wallets.owners.count) {
+        system.wallets.owners.capacity *= 2;
+    }
+    system.wallets.items = new (std::nothrow) Wallet[system.wallets.capacity];
+    system.wallets.owners.items = new (std::nothrow) char[system.wallets.owners.capacity];
+    if (walletsFile.is_open()) {
+        walletsFile.read((char*)system.wallets.items, system.wallets.count * sizeof(Wallet));
+        walletsFile.read(system.wallets.owners.items, system.wallets.owners.count);
         walletsFile.close();
     }
-    else {
-        system.wallets.capacity = INITIAL_CAPACITY;
-        system.wallets.count = 0;
-        system.wallets.items = new (std::nothrow) Wallet[INITIAL_CAPACITY];
+    for (size_t offset = 0; offset < system.wallets.owners.count; offset += strlen(system.wallets.owners.items + offset) + 1) {
+        system.wallets.owners.names++;
+    }
+    rebuildNameIndex(system.wallets.owners);
+
+    system.wallets.executedOrders = new (std::nothrow) size_t[system.wallets.capacity];
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        system.wallets.executedOrders[i] = 0;
+    }
+    std::ifstream executedOrdersFile(EXECUTED_ORDERS_FILENAME, std::ios::binary);
+    if (executedOrdersFile.is_open()) {
+        executedOrdersFile.read((char*)system.wallets.executedOrders, system.wallets.count * sizeof(size_t));
+        executedOrdersFile.close();
+    }
+    system.wallets.index = nullptr;
+    rebuildWalletIndex(system.wallets);
+
+    SnapshotHeader snapshot = readSnapshot();
+    loadTransactions(system.transactions, snapshot);
+
+    system.orders.count = 0;
+    system.orders.capacity = 0;
+    initChunkedArray(system.orders.items);
+    initChunkedArray(system.orders.executed);
+    initChunkedArray(system.orders.times);
+    initChunkedArray(system.orders.next);
+    initChunkedArray(system.orders.previous);
+    system.orders.nextId = 0;
+    std::ifstream ordersFile(ORDERS_FILENAME, std::ios::binary);
+    if (ordersFile.is_open()) {
+        size_t fileSize = getFileSize(ordersFile);
+        OrdersHeader header;
+        memset(&header, 0, sizeof(OrdersHeader));
+        ordersFile.read((char*)&header, sizeof(OrdersHeader));
+        bool versioned = ordersFile && memcmp(header.magic, ORDERS_MAGIC, sizeof(ORDERS_MAGIC)) == 0;
+        size_t orderCount = 0;
+        bool timed = versioned && header.version == ORDERS_VERSION;
+        size_t recordSize = sizeof(Order) + sizeof(bool) + (timed ? sizeof(long long) : 0);
+        if (!versioned) {
+            ordersFile.clear();
+            ordersFile.seekg(0);
+            orderCount = fileSize / sizeof(Order);
+            system.orders.nextId = orderCount;
+        }
+        else if ((timed || header.version == LEGACY_ORDERS_VERSION) && header.recordSize == sizeof(Order) &&
+            sizeof(OrdersHeader) + header.count * recordSize == fileSize) {
+            orderCount = header.count;
+            system.orders.nextId = header.nextId;
+        }
+        else {
+            std::cout << "Unsupported format of " << ORDERS_FILENAME << ", ignoring its contents" << std::endl;
+        }
+        while (system.orders.capacity < orderCount) {
+            resizeOrderContainer(system);
+        }
+        for (size_t chunk = 0; chunk * CHUNK_SIZE < orderCount; chunk++) {
+            size_t remaining = orderCount - chunk * CHUNK_SIZE;
+            ordersFile.read((char*)system.orders.items.chunks[chunk],
+                (remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE) * sizeof(Order));
+        }
+        for (size_t chunk = 0; chunk * CHUNK_SIZE < orderCount; chunk++) {
+            size_t remaining = orderCount - chunk * CHUNK_SIZE;
+            if (versioned) {
+                ordersFile.read((char*)system.orders.executed.chunks[chunk],
+                    (remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE) * sizeof(bool));
+            }
+            else {
+                for (size_t i = 0; i < remaining && i < CHUNK_SIZE; i++) {
+                    system.orders.executed.chunks[chunk][i] = system.orders.items.chunks[chunk][i].remainingCoins <= 0;
+                }
+            }
+        }
+        for (size_t chunk = 0; chunk * CHUNK_SIZE < orderCount; chunk++) {
+            size_t remaining = orderCount - chunk * CHUNK_SIZE;
+            if (timed) {
+                ordersFile.read((char*)system.orders.times.chunks[chunk],
+                    (remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE) * sizeof(long long));
+            }
+            else {
+                // Older files carry no order times, so their orders count as older than any watermark
+                for (size_t i = 0; i < remaining && i < CHUNK_SIZE; i++) {
+                    system.orders.times.chunks[chunk][i] = 0;
+                }
+            }
+        }
+        system.orders.count = orderCount;
+        ordersFile.close();
+    }
+
+    system.fills.count = 0;
+    system.fills.capacity = 0;
+    initChunkedArray(system.fills.items);
+    std::ifstream fillsFile(FILLS_FILENAME, std::ios::binary);
+    if (fillsFile.is_open()) {
+        size_t fillCount = getFileSize(fillsFile) / sizeof(Fill);
+        if (snapshot.fillCount < fillCount) {
+            fillCount = snapshot.fillCount;
+        }
+        while (system.fills.capacity < fillCount) {
+            if (!resizeFillContainer(system.fills)) {
+                std::cout << "Not enough memory to load " << FILLS_FILENAME << std::endl;
+                fillCount = system.fills.capacity;
+            }
+        }
+        for (size_t chunk = 0; chunk * CHUNK_SIZE < fillCount; chunk++) {
+            size_t remaining = fillCount - chunk * CHUNK_SIZE;
+            fillsFile.read((char*)system.fills.items.chunks[chunk], (remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE) * sizeof(Fill));
+        }
+        system.fills.count = fillCount;
+        fillsFile.close();
+    }
+    system.fills.persistedCount = system.fills.count;
+
+    long long filesTime = getMicroseconds();
+
+    system.bids.side = Order::Type::BUY;
+    system.bids.levels = new (std::nothrow) PriceLevel[INITIAL_CAPACITY];
+    system.bids.capacity = system.bids.levels != nullptr ? INITIAL_CAPACITY : 0;
+    system.asks.side = Order::Type::SELL;
+    system.asks.levels = new (std::nothrow) PriceLevel[INITIAL_CAPACITY];
+    system.asks.capacity = system.asks.levels != nullptr ? INITIAL_CAPACITY : 0;
+    if (!rebuildOrderBooks(system)) {
+        std::cout << "Not enough memory to rebuild the order books" << std::endl;
+    }
+    long long orderBooksTime = getMicroseconds();
+
+    system.wallets.histories = new (std::nothrow) WalletHistory[system.wallets.capacity];
+    for (size_t i = 0; i < system.wallets.count; i++) {
+        system.wallets.histories[i] = { nullptr, 0, 0, 0, -1, -1 };
+    }
+    system.wallets.historiesIndexed = false;
+    system.wallets.archiveIndexed = false;
+    system.wallets.carriedForward = 0;
+
+    system.wallets.volumes = new (std::nothrow) WalletVolume[system.wallets.capacity];
+    if (!initMarketData(system.market)) {
+        std::cout << "Not enough memory for market data, some intervals are unavailable" << std::endl;
+    }
+    rebuildMarketData(system);
+
+    system.wallets.reservedFiat = new (std::nothrow) double[system.wallets.capacity];
+    system.wallets.reservedCoins = new (std::nothrow) double[system.wallets.capacity];
+    rebuildReservations(system);
+
+    system.wallets.coins = new (std::nothrow) double[system.wallets.capacity];
+    bool balancesLoaded = false;
+    std::ifstream balancesFile(BALANCES_FILENAME, std::ios::binary);
+    if (balancesFile.is_open()) {
+        unsigned long long counts[2] = { 0, 0 };
+        balancesFile.read((char*)counts, sizeof(counts));
+        if (!options.validateLedger && counts[0] == ledgerSize(system.transactions) && counts[1] == system.wallets.count) {
+            balancesLoaded = (bool)balancesFile.read((char*)system.wallets.coins, system.wallets.count * sizeof(double));
+        }
+        balancesFile.close();
+    }
+    bool ledgerValid = true;
+    if (!balancesLoaded) {
+        ledgerValid = replayLedgerInParallel(system, options.threads);
+    }
+    long long balancesTime = getMicroseconds();
+
+    system.leaderboard.count = 0;
+    system.leaderboard.outsideCoins = 0;
+    system.leaderboard.valid = false;
+    system.checkpoint.active = false;
+    system.checkpoint.finished = true;
+    system.checkpoint.lastTime = getTime();
+    system.checkpoint.interval = options.checkpointInterval;
+    openJournal(system, snapshot.sequence);
+    system.journal.groupCommitCount = options.groupCommitCount;
+    system.ids.strategy = options.idStrategy;
+    system.ids.state = options.seeded ? options.idSeed : ((unsigned long long)std::random_device()() << 32) ^ getMicroseconds();
+    system.ids.key = options.seeded ? (unsigned)nextRandom(system.ids.state) : 0x5bd1e995u;
+    system.ids.counter = system.wallets.count;
+    system.journal.groupCommitWindow = options.groupCommitWindow;
+    startJournalFlusher(system.journal);
+    long long journalTime = getMicroseconds();
+
+    std::cout << "Startup: files " << (filesTime - startTime) / 1000 << " ms, order books "
+        << (orderBooksTime - filesTime) / 1000 << " ms, balances " << (balancesTime - orderBooksTime) / 1000 << " ms";
+    if (balancesLoaded) {
+        std::cout << " (loaded)";
+    }
+    else {
+        std::cout << " (replayed on " << (options.threads > 0 ? options.threads : 1) << " threads, "
+            << (ledgerValid ? "valid" : "invalid") << ")";
+    }
+    std::cout << ", journal " << (journalTime - balancesTime) / 1000 << " ms" << std::endl;
+}
+
+bool nextToken(const char*& position, const char* end, const char*& token, size_t& length) {
+    while (position < end && (*position == ' ' || *position == '\t' || *position == '\r')) {
+        position++;
+    }
+    token = position;
+    while (position < end && *position != ' ' && *position != '\t' && *position != '\r') {
+        position++;
+    }
+    length = position - token;
+    return length > 0;
+}
+
+template <typename T>
+bool parseToken(const char*& position, const char* end, T& value) {
+    const char* token;
+    size_t length;
+    return nextToken(position, end, token, length) && std::from_chars(token, token + length, value).ptr == token + length;
+}
+
+long long addWallets(System& system, const char filename[], const char idsFilename[], size_t& failed) {
+    size_t size = 0;
+    void* view = mapFile(filename, size);
+    if (view == nullptr) {
+        std::ifstream walletsFile(filename, std::ios::binary);
+        return walletsFile.is_open() ? 0 : -1;
+    }
+    FILE* idsFile = nullptr;
+    if (idsFilename != nullptr && (idsFile = fopen(idsFilename, "wb")) == nullptr) {
+        unmapFile(view, size);
+        return -1;
+    }
+
+    const char* data = (const char*)view;
+    const char* end = data + size;
+    size_t lines = 1;
+    for (const char* newline = data; (newline = (const char*)memchr(newline, '\n', end - newline)) != nullptr; newline++) {
+        lines++;
+    }
+    if (system.wallets.capacity < system.wallets.count + lines) {
+        resizeWalletContainer(system, system.wallets.count + lines);
+    }
+
+    bool flushEachRecord = system.journal.flushEachRecord;
+    bool deferCommit = system.journal.deferCommit;
+    size_t groupCommitCount = system.journal.groupCommitCount;
+    system.journal.flushEachRecord = false;
+    system.journal.deferCommit = true;
+    system.journal.groupCommitCount = (size_t)-1;
+    long long added = 0;
+    failed = 0;
+    char owner[256];
+    char idText[16];
+    for (const char* position = data; position < end; ) {
+        const char* lineEnd = (const char*)memchr(position, '\n', end - position);
+        if (lineEnd == nullptr) {
+            lineEnd = end;
+        }
+        double fiatMoney;
+        const char* name;
+        size_t nameLength;
+        const char* lineStart = position;
+        if (!nextToken(lineStart, lineEnd, name, nameLength)) {
+            position = lineEnd + 1;
+            continue;
+        }
+        if (parseToken(position, lineEnd, fiatMoney) && nextToken(position, lineEnd, name, nameLength) &&
+            nameLength < sizeof(owner)) {
+            memcpy(owner, name, nameLength);
+            owner[nameLength] = '\0';
+            long long walletId = addWallet(system, fiatMoney, owner);
+            if (walletId != -1) {
+                added++;
+                if (idsFile != nullptr) {
+                    char* idEnd = std::to_chars(idText, idText + sizeof(idText) - 1, walletId).ptr;
+                    *idEnd++ = '\n';
+                    fwrite(idText, 1, idEnd - idText, idsFile);
+                }
+            }
+            else {
+                failed++;
+            }
+        }
+        else {
+            failed++;
+        }
+        position = lineEnd + 1;
+    }
+    system.journal.flushEachRecord = flushEachRecord;
+    system.journal.deferCommit = deferCommit;
+    system.journal.groupCommitCount = groupCommitCount;
+    bool synced = syncJournal(system.journal);
+    if (idsFile != nullptr) {
+        fclose(idsFile);
+    }
+    unmapFile(view, size);
+    return synced ? added : -1;
+}
+
+void printStats(std::ostream& output) {
+#ifdef EXCHANGE_STATS
+    for (int i = 0; i < Stats::OPERATION_COUNT; i++) {
+        const LatencyHistogram& histogram = statistics.latencies[i];
+        unsigned long long total = histogram.total.load(std::memory_order_relaxed);
+        if (total == 0) {
+            continue;
+        }
+        output << STATS_OPERATION_NAMES[i] << ": " << total << " calls, p50 " << latencyPercentile(histogram, 50)
+            << " ns, p99 " << latencyPercentile(histogram, 99) << " ns, p999 " << latencyPercentile(histogram, 99.9)
+            << " ns, max " << histogram.max.load(std::memory_order_relaxed) << " ns" << std::endl;
+    }
+    for (int i = 0; i < Stats::COUNTER_COUNT; i++) {
+        output << STATS_COUNTER_NAMES[i] << ": " << statistics.counters[i].load(std::memory_order_relaxed) << std::endl;
+    }
+#else
+    output << "Statistics are not compiled into this build" << std::endl;
+#endif
+}
+
+bool writeStatsJson(const char filename[]) {
+#ifdef EXCHANGE_STATS
+    std::ofstream statsFile(filename);
+    if (!statsFile.is_open()) {
+        return false;
+    }
+    statsFile << "{\"latencies\":{";
+    for (int i = 0; i < Stats::OPERATION_COUNT; i++) {
+        const LatencyHistogram& histogram = statistics.latencies[i];
+        statsFile << (i > 0 ? "," : "") << "\"" << STATS_OPERATION_NAMES[i] << "\":{\"count\":"
+            << histogram.total.load(std::memory_order_relaxed) << ",\"p50\":" << latencyPercentile(histogram, 50)
+            << ",\"p99\":" << latencyPercentile(histogram, 99) << ",\"p999\":" << latencyPercentile(histogram, 99.9)
+            << ",\"max\":" << histogram.max.load(std::memory_order_relaxed) << "}";
+    }
+    statsFile << "},\"counters\":{";
+    for (int i = 0; i < Stats::COUNTER_COUNT; i++) {
+        statsFile << (i > 0 ? "," : "") << "\"" << STATS_COUNTER_NAMES[i] << "\":"
+            << statistics.counters[i].load(std::memory_order_relaxed);
+    }
+    statsFile << "}}" << std::endl;
+    return (bool)statsFile;
+#else
+    return false;
+#endif
+}
+
+void displayCommands() {
+    std::cout << "COMMANDS" << std::endl;
+    std::cout << "add-wallet **fiatMoney** **name**" << std::endl;
+    std::cout << "add-wallets **filename** [idsFilename]" << std::endl;
+    std::cout << "make-order **type** **grnCoins** **walletId** **price**" << std::endl;
+    std::cout << "cancel-order **orderId**" << std::endl;
+    std::cout << "transfer **senderId** **receiverId** **grnCoins**" << std::endl;
+    std::cout << "transfer-batch **count** **senderId** **receiverId** **grnCoins** [...]" << std::endl;
+    std::cout << "wallet-info **walletId**" << std::endl;
+    std::cout << "wallet-history **walletId** [from] [to]" << std::endl;
+    std::cout << "market-stats [interval]" << std::endl;
+    std::cout << "wallet-stats **walletId**" << std::endl;
+    std::cout << "attract-investors" << std::endl;
+    std::cout << "generate-report **filename** **csv|json** [walletId|all] [from] [to]" << std::endl;
+    std::cout << "check-balances" << std::endl;
+    std::cout << "audit-wallets **walletId** [walletId...]" << std::endl;
+    std::cout << "checkpoint" << std::endl;
+    std::cout << "compact **watermark**" << std::endl;
+    std::cout << "stats" << std::endl;
+    std::cout << "quit" << std::endl;
+}
+
+bool executeCommand(System& system, const char command[], std::istream& input, std::ostream& output) {
+    if (strcmp(command, "add-wallet")==0) {
+        double fiatMoney;
+        char name[MAX_INPUT_LENGTH];
+        input >> fiatMoney >> name;
+        long long result = addWallet(system, fiatMoney, name);
+        if (result!=-1) {
+            output << "Successfully added wallet with ID " << result << std::endl;
+        }
+        else {
+            output << "Could not add wallet" << std::endl;
+        }
+    }
+    else if (strcmp(command, "add-wallets")==0) {
+        char filename[MAX_INPUT_LENGTH], idsFilename[MAX_INPUT_LENGTH];
+        input >> filename;
+        char arguments[MAX_INPUT_LENGTH];
+        input.getline(arguments, MAX_INPUT_LENGTH);
+        bool writeIds = sscanf(arguments, "%1023s", idsFilename) == 1;
+
+        long long startTime = getMicroseconds();
+        size_t failed = 0;
+        long long added = addWallets(system, filename, writeIds ? idsFilename : nullptr, failed);
+        long long elapsed = getMicroseconds() - startTime;
+        if (added != -1) {
+            output << "Added " << added << " wallets in " << elapsed / 1000 << " ms";
+            if (failed > 0) {
+                output << ", " << failed << " lines could not be imported";
+            }
+            output << std::endl;
+        }
+        else {
+            output << "Could not import wallets" << std::endl;
+        }
+    }
+    else if (strcmp(command, "make-order")==0) {
+        char type[MAX_INPUT_LENGTH];
+        double grnCoins, price;
+        unsigned walletId;
+        input >> type >> grnCoins >> walletId >> price;
+        if (strcmp(type, "buy")==0 || strcmp(type, "sell")==0) {
+            long long orderId = addOrder(system, walletId, strcmp(type, "buy")==0 ? Order::Type::BUY : Order::Type::SELL,
+                grnCoins, price);
+            if (orderId != -1) {
+                output << "Successfully added order with ID " << orderId << std::endl;
+            }
+            else {
+                output << "Could not add order" << std::endl;
+            }
+        }
+        else {
+            output << "Invalid type of order" << std::endl;
+        }
+    }
+    else if (strcmp(command, "cancel-order")==0) {
+        unsigned long long orderId;
+        input >> orderId;
+        if (cancelOrder(system, orderId)) {
+            output << "Successfully cancelled order" << std::endl;
+        }
+        else {
+            output << "Could not cancel order" << std::endl;
+        }
+    }
+    else if (strcmp(command, "transfer")==0) {
+        unsigned senderId, receiverId;
+        double grnCoins;
+        input >> senderId >> receiverId >> grnCoins;
+        if (transfer(system, senderId, receiverId, grnCoins)) {
+            output << "Successful transfer" << std::endl;
+        }
+        else {
+            output << "Unsuccessful transfer" << std::endl;
+        }
+    }
+    else if (strcmp(command, "transfer-batch")==0) {
+        size_t count = 0;
+        input >> count;
+        TransferRequest* transfers = new (std::nothrow) TransferRequest[count > 0 ? count : 1];
+        size_t parsed = 0;
+        while (transfers != nullptr && parsed < count &&
+            input >> transfers[parsed].senderId >> transfers[parsed].receiverId >> transfers[parsed].grnCoins) {
+            parsed++;
+        }
+        if (transfers != nullptr && parsed == count && transferBatch(system, transfers, count)) {
+            output << "Successful batch of " << count << " transfers" << std::endl;
+        }
+        else {
+            output << "Unsuccessful batch transfer" << std::endl;
+        }
+        delete[] transfers;
+    }
+    else if (strcmp(command, "wallet-info")==0) {
+        unsigned walletId;
+        input >> walletId;
+        walletInfo(system, walletId, output);
+    }
+    else if (strcmp(command, "wallet-history")==0) {
+        unsigned walletId;
+        input >> walletId;
+        char arguments[MAX_INPUT_LENGTH];
+        input.getline(arguments, MAX_INPUT_LENGTH);
+        unsigned long long from = 0, to = 0;
+        int argumentsCount = sscanf(arguments, "%llu %llu", &from, &to);
+        if (argumentsCount < 2) {
+            to = from + HISTORY_PAGE_SIZE;
+        }
+        walletHistory(system, walletId, from, to, output);
+    }
+    else if (strcmp(command, "market-stats")==0) {
+        char arguments[MAX_INPUT_LENGTH];
+        input.getline(arguments, MAX_INPUT_LENGTH);
+        long long interval = MARKET_INTERVALS[0];
+        sscanf(arguments, "%lld", &interval);
+        marketStats(system, interval, output);
+    }
+    else if (strcmp(command, "wallet-stats")==0) {
+        unsigned walletId = 0;
+        input >> walletId;
+        walletStats(system, walletId, output);
     }
+    else if (strcmp(command, "generate-report")==0) {
+        char filename[MAX_INPUT_LENGTH], format[MAX_INPUT_LENGTH], wallet[MAX_INPUT_LENGTH];
+        input >> filename >> format;
+        char arguments[MAX_INPUT_LENGTH];
+        input.getline(arguments, MAX_INPUT_LENGTH);
 
-    std::ifstream executedOrdersFile(EXECUTED_ORDERS_FILENAME, std::ios::binary);
-    if (executedOrdersFile.is_open()) {
-        system.wallets.executedOrders = new (std::nothrow) size_t[system.wallets.capacity];
-        walletsFile.read((char*)&system.wallets.executedOrders, system.wallets.count * sizeof(size_t));
-        executedOrdersFile.close();
+        ReportOptions options;
+        options.filename = filename;
+        options.format = strcmp(format, "json") == 0 ? ReportOptions::Format::JSON : ReportOptions::Format::CSV;
+        options.from = LLONG_MIN;
+        options.to = LLONG_MAX;
+        int argumentsCount = sscanf(arguments, "%1023s %lld %lld", wallet, &options.from, &options.to);
+        options.filterWallet = argumentsCount >= 1 && strcmp(wallet, "all") != 0;
+        options.walletId = options.filterWallet ? (unsigned)strtoul(wallet, nullptr, 10) : 0;
+
+        long long startTime = getMicroseconds();
+        long long records = generateTextFile(system, options);
+        long long elapsed = getMicroseconds() - startTime;
+        if (records != -1) {
+            output << "Exported " << records << " records in " << elapsed / 1000 << " ms ("
+                << (long long)(records * 1000000.0 / (elapsed > 0 ? elapsed : 1)) << " records/s)" << std::endl;
+        }
+        else {
+            output << "Could not generate report" << std::endl;
+        }
     }
-    else {
-        system.wallets.executedOrders = new (std::nothrow) size_t[INITIAL_CAPACITY];
+    else if (strcmp(command, "attract-investors")==0) {
+        attractInvestors(system, output);
+    }
+    else if (strcmp(command, "check-balances")==0) {
+        if (checkBalances(system, output)) {
+            output << "Balances are consistent with the ledger" << std::endl;
+        }
+    }
+    else if (strcmp(command, "audit-wallets")==0) {
+        char arguments[MAX_INPUT_LENGTH];
+        if (!input.getline(arguments, MAX_INPUT_LENGTH) && !input.eof()) {
+            input.clear();
+            input.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            output << "Too many wallet IDs, the list must fit in " << MAX_INPUT_LENGTH << " characters" << std::endl;
+        }
+        else {
+            unsigned walletIds[MAX_INPUT_LENGTH / 2];
+            size_t walletCount = 0;
+            char* cursor = arguments;
+            char* end;
+            for (unsigned long walletId = strtoul(cursor, &end, 10); end != cursor && walletCount < MAX_INPUT_LENGTH / 2;
+                walletId = strtoul(cursor, &end, 10)) {
+                walletIds[walletCount++] = (unsigned)walletId;
+                cursor = end;
+            }
+            auditWallets(system, walletIds, walletCount, output);
+        }
+    }
+    else if (strcmp(command, "stats")==0) {
+        printStats(output);
+    }
+    else if (strcmp(command, "compact")==0) {
+        long long watermark;
+        input >> watermark;
+        size_t archivedOrders, archivedFills, archivedTransactions;
+        if (watermark > newestLedgerTime(system)) {
+            output << "Watermark must not be later than the newest ledger record at " << newestLedgerTime(system) << std::endl;
+        }
+        else if (compactSystem(system, watermark, archivedOrders, archivedFills, archivedTransactions)) {
+            output << "Archived " << archivedOrders << " orders, " << archivedFills << " fills and " << archivedTransactions
+                << " transactions" << std::endl;
+        }
+        else {
+            output << "Could not compact data" << std::endl;
+        }
+    }
+    else if (strcmp(command, "checkpoint")==0) {
+        if (startCheckpoint(system)) {
+            output << "Checkpoint started" << std::endl;
+        }
+        else {
+            output << "A checkpoint is already in progress" << std::endl;
+        }
+    }
+    else if (strcmp(command, "quit")==0) {
+        if (quit(system)) {
+            output << "Successfully saved data" << std::endl;
+        }
+        else {
+            output << "Could not save data" << std::endl;
+        }
+        return false;
+    }
+    return true;
+}
+
+size_t hashCommand(const char* name, const size_t length) {
+    return (2 * length + (unsigned char)name[0] + 15 * (unsigned char)name[length - 1]) & (BATCH_COMMAND_TABLE_SIZE - 1);
+}
+
+void buildCommandTable(CommandTable& table) {
+    for (size_t i = 0; i < BATCH_COMMAND_TABLE_SIZE; i++) {
+        table.slots[i] = -1;
+    }
+    for (int i = 0; i < BATCH_COMMAND_COUNT; i++) {
+        table.lengths[i] = strlen(BATCH_COMMAND_NAMES[i]);
+        table.slots[hashCommand(BATCH_COMMAND_NAMES[i], table.lengths[i])] = i;
     }
+}
+
+int findCommand(const CommandTable& table, const char* name, const size_t length) {
+    int command = table.slots[hashCommand(name, length)];
+    if (command == -1 || table.lengths[command] != length || memcmp(BATCH_COMMAND_NAMES[command], name, length) != 0) {
+        return -1;
+    }
+    return command;
+}
 
-    std::ifstream transactionsFile(TRANSACTIONS_FILENAME, std::ios::binary);
-    if (transactionsFile.is_open()) {
-        size_t fileSize = getFileSize(transactionsFile);
-        system.transactions.count = fileSize / sizeof(Transaction);
-        system.transactions.capacity = system.transactions.count;
-        std::cout << system.transactions.count << std::endl;
-        system.transactions.items = new (std::nothrow) Transaction[system.transactions.capacity];
-        transactionsFile.read((char*)&system.transactions.items, fileSize);
-        transactionsFile.close();
+bool executeBatchCommand(System& system, const int command, const char* position, const char* end,
+    ReportWriter& writer) {
+    if (command == ADD_WALLET_COMMAND) {
+        double fiatMoney;
+        const char* name;
+        size_t nameLength;
+        char owner[256];
+        long long result = -1;
+        if (parseToken(position, end, fiatMoney) && nextToken(position, end, name, nameLength) && nameLength < sizeof(owner)) {
+            memcpy(owner, name, nameLength);
+            owner[nameLength] = '\0';
+            result = addWallet(system, fiatMoney, owner);
+        }
+        if (result != -1) {
+            writeReportText(writer, "Successfully added wallet with ID ");
+            writeReportNumber(writer, result);
+            writeReportText(writer, "\n");
+        }
+        else {
+            writeReportText(writer, "Could not add wallet\n");
+        }
+    }
+    else if (command == MAKE_ORDER_COMMAND) {
+        const char* type;
+        size_t typeLength;
+        double grnCoins, price;
+        unsigned walletId;
+        bool parsed = nextToken(position, end, type, typeLength) && parseToken(position, end, grnCoins) &&
+            parseToken(position, end, walletId) && parseToken(position, end, price);
+        bool buy = typeLength == 3 && memcmp(type, "buy", 3) == 0;
+        bool sell = typeLength == 4 && memcmp(type, "sell", 4) == 0;
+        if (!buy && !sell) {
+            writeReportText(writer, "Invalid type of order\n");
+        }
+        else {
+            long long orderId = parsed ? addOrder(system, walletId, buy ? Order::Type::BUY : Order::Type::SELL, grnCoins, price) : -1;
+            if (orderId != -1) {
+                writeReportText(writer, "Successfully added order with ID ");
+                writeReportNumber(writer, orderId);
+                writeReportText(writer, "\n");
+            }
+            else {
+                writeReportText(writer, "Could not add order\n");
+            }
+        }
+    }
+    else if (command == TRANSFER_COMMAND) {
+        unsigned senderId, receiverId;
+        double grnCoins;
+        if (parseToken(position, end, senderId) && parseToken(position, end, receiverId) &&
+            parseToken(position, end, grnCoins) && transfer(system, senderId, receiverId, grnCoins)) {
+            writeReportText(writer, "Successful transfer\n");
+        }
+        else {
+            writeReportText(writer, "Unsuccessful transfer\n");
+        }
     }
     else {
-        system.transactions.capacity = INITIAL_CAPACITY;
-        system.transactions.count = 0;
-        system.transactions.items = new (std::nothrow) Transaction[INITIAL_CAPACITY];
+        std::istringstream input(std::string(position, end));
+        std::ostringstream output;
+        bool running = executeCommand(system, BATCH_COMMAND_NAMES[command], input, output);
+        std::string text = output.str();
+        writeReportBytes(writer, text.data(), text.size());
+        return running;
     }
+    return true;
+}
 
-    std::ifstream ordersFile(ORDERS_FILENAME, std::ios::binary);
-    if (ordersFile.is_open()) {
-        size_t fileSize = getFileSize(ordersFile);
-        system.orders.count = fileSize / sizeof(Order);
-        system.orders.capacity = system.orders.count;
-        system.orders.items = new (std::nothrow) Order[system.orders.capacity];
-        ordersFile.read((char*)&system.orders.items, system.orders.count * sizeof(Order));
-        ordersFile.close();
+bool runBatch(System& system, const char filename[]) {
+    size_t size = 0;
+    void* view = nullptr;
+    char* buffer = nullptr;
+    const char* data;
+    if (strcmp(filename, "-") == 0) {
+        size_t capacity = REPORT_BUFFER_SIZE;
+        buffer = new (std::nothrow) char[capacity];
+        size_t received;
+        while (buffer != nullptr && (received = fread(buffer + size, 1, capacity - size, stdin)) > 0) {
+            size += received;
+            if (size == capacity) {
+                char* grown = new (std::nothrow) char[capacity * 2];
+                if (grown == nullptr) {
+                    delete[] buffer;
+                    buffer = nullptr;
+                    break;
+                }
+                memcpy(grown, buffer, size);
+                delete[] buffer;
+                buffer = grown;
+                capacity *= 2;
+            }
+        }
+        if (buffer == nullptr) {
+            std::cout << "Not enough memory to read the batch" << std::endl;
+            return false;
+        }
+        data = buffer;
     }
     else {
-        system.orders.capacity = INITIAL_CAPACITY;
-        system.orders.count = 0;
-        system.orders.items = new (std::nothrow) Order[INITIAL_CAPACITY];
+        std::ifstream batchFile(filename, std::ios::binary);
+        if (!batchFile.is_open()) {
+            std::cout << "Could not open batch file " << filename << std::endl;
+            return false;
+        }
+        batchFile.close();
+        view = mapFile(filename, size);
+        data = (const char*)view;
     }
-    system.orders.executed = new (std::nothrow) bool[system.orders.capacity];
-    for (size_t i = 0; i < system.orders.count; i++) {
-        system.orders.executed[i] = false;
+
+    ReportWriter writer;
+    writer.file = stdout;
+    writer.buffer = new (std::nothrow) char[REPORT_BUFFER_SIZE];
+    if (writer.buffer == nullptr) {
+        std::cout << "Not enough memory to run the batch" << std::endl;
+        if (view != nullptr) {
+            unmapFile(view, size);
+        }
+        delete[] buffer;
+        return false;
+    }
+    writer.size = 0;
+    writer.format = ReportOptions::Format::CSV;
+    writer.failed = false;
+
+    CommandTable table;
+    buildCommandTable(table);
+    BatchStats stats;
+    memset(&stats, 0, sizeof(stats));
+    system.journal.flushEachRecord = false;
+    system.journal.deferCommit = true;
+    system.journal.groupCommitCount = (size_t)-1;
+
+    long long startTime = getNanoseconds();
+    bool running = true;
+    const char* position = data;
+    const char* end = data + (data != nullptr ? size : 0);
+    while (running && position < end) {
+        const char* lineEnd = (const char*)memchr(position, '\n', end - position);
+        if (lineEnd == nullptr) {
+            lineEnd = end;
+        }
+        const char* name;
+        size_t length;
+        if (nextToken(position, lineEnd, name, length)) {
+            int command = findCommand(table, name, length);
+            if (command == -1) {
+                stats.unknownCommands++;
+            }
+            else {
+                long long commandStart = getNanoseconds();
+                running = executeBatchCommand(system, command, position, lineEnd, writer);
+                long long elapsed = getNanoseconds() - commandStart;
+                stats.counts[command]++;
+                stats.times[command] += elapsed;
+                if (elapsed > stats.maxTimes[command]) {
+                    stats.maxTimes[command] = elapsed;
+                }
+                checkpointIfDue(system);
+            }
+        }
+        position = lineEnd + 1;
+    }
+    if (running) {
+        std::istringstream input;
+        std::ostringstream output;
+        executeCommand(system, BATCH_COMMAND_NAMES[QUIT_COMMAND], input, output);
+        std::string text = output.str();
+        writeReportBytes(writer, text.data(), text.size());
+    }
+    long long elapsed = getNanoseconds() - startTime;
+    flushReport(writer);
+    fflush(stdout);
+    delete[] writer.buffer;
+    if (view != nullptr) {
+        unmapFile(view, size);
+    }
+    delete[] buffer;
+
+    size_t commandCount = 0;
+    for (int i = 0; i < BATCH_COMMAND_COUNT; i++) {
+        commandCount += stats.counts[i];
+    }
+    std::cout << "Batch: " << commandCount << " commands in " << elapsed / 1000000 << " ms ("
+        << (long long)(commandCount * 1000000000.0 / (elapsed > 0 ? elapsed : 1)) << " commands/s)";
+    if (stats.unknownCommands > 0) {
+        std::cout << ", " << stats.unknownCommands << " unknown commands skipped";
+    }
+    std::cout << std::endl;
+    for (int i = 0; i < BATCH_COMMAND_COUNT; i++) {
+        if (stats.counts[i] > 0) {
+            std::cout << "  " << BATCH_COMMAND_NAMES[i] << ": " << stats.counts[i] << " commands, average "
+                << stats.times[i] / (long long)stats.counts[i] << " ns, max " << stats.maxTimes[i] << " ns" << std::endl;
+        }
     }
+    return !writer.failed;
 }
 
-void displayCommands() {
-    std::cout << "COMMANDS" << std::endl;
-    std::cout << "add-wallet **fiatMoney** **name**" << std::endl;
-    std::cout << "make-order **type** **grnCoins** **walletId**" << std::endl;
-    std::cout << "transfer **senderId** **receiverId** **grnCoins**" << std::endl;
-    std::cout << "wallet-info **walletId**" << std::endl;
-    std::cout << "attract-investors" << std::endl;
-    std::cout << "quit" << std::endl;
+#ifdef EXCHANGE_SERVER
+struct Connection {
+    int fd;
+    char buffer[CONNECTION_BUFFER_SIZE];
+    size_t length;
+};
+
+struct SequencedCommand {
+    const char* line;
+    std::ostream* output;
+    unsigned long long sequence;
+    bool done;
+};
+
+template <typename T>
+struct ServerQueue {
+    T* items[SERVER_QUEUE_CAPACITY];
+    size_t head, count;
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+};
+
+struct Server {
+    System* system;
+    Connection listener, signals;
+    int epollFd;
+    std::shared_mutex walletsMutex;
+    std::mutex walletShards[WALLET_SHARD_COUNT];
+    std::mutex ledgerMutex;
+    ServerQueue<Connection> connections;
+    ServerQueue<SequencedCommand> commands;
+    std::mutex completedMutex;
+    std::condition_variable completed;
+};
+
+template <typename T>
+void pushServerQueue(ServerQueue<T>& queue, T* item) {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.notFull.wait(lock, [&queue] { return queue.count < SERVER_QUEUE_CAPACITY; });
+    queue.items[(queue.head + queue.count++) % SERVER_QUEUE_CAPACITY] = item;
+    queue.notEmpty.notify_one();
 }
 
-int main()
-{
-    System system;
-    loadSystem(system);
+template <typename T>
+bool popServerQueue(ServerQueue<T>& queue, T*& item, const long long timeout) {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    auto hasItems = [&queue] { return queue.count > 0; };
+    if (timeout < 0) {
+        queue.notEmpty.wait(lock, hasItems);
+    }
+    else if (!queue.notEmpty.wait_for(lock, std::chrono::milliseconds(timeout), hasItems)) {
+        return false;
+    }
+    item = queue.items[queue.head];
+    queue.head = (queue.head + 1) % SERVER_QUEUE_CAPACITY;
+    queue.count--;
+    queue.notFull.notify_one();
+    return true;
+}
 
-    std::cout << "Welcome" << std::endl << std::endl;
-    displayCommands();
-    std::cout << std::endl;
+size_t walletShard(const unsigned walletId) {
+    return hashWalletId(walletId, WALLET_SHARD_COUNT);
+}
 
-    char command[MAX_INPUT_LENGTH];
-    std::cin >> command;
+bool serverTransfer(Server& server, const unsigned senderId, const unsigned receiverId, const double grnCoins,
+    unsigned long long& sequence) {
+    MEASURE_LATENCY(TRANSFER);
+    std::shared_lock<std::shared_mutex> walletsLock(server.walletsMutex);
+    size_t firstShard = walletShard(senderId), secondShard = walletShard(receiverId);
+    if (secondShard < firstShard) {
+        std::swap(firstShard, secondShard);
+    }
+    std::unique_lock<std::mutex> firstLock(server.walletShards[firstShard]);
+    std::unique_lock<std::mutex> secondLock;
+    if (secondShard != firstShard) {
+        secondLock = std::unique_lock<std::mutex>(server.walletShards[secondShard]);
+    }
+    System& system = *server.system;
+    if (!canTransfer(system, senderId, receiverId, grnCoins)) {
+        return false;
+    }
+
+    Transaction transaction;
+    transaction.senderId = senderId;
+    transaction.receiverId = receiverId;
+    transaction.grnCoins = grnCoins;
+    transaction.time = getTime();
+    JournalRecord record = makeJournalRecord(JournalRecord::Type::TRANSFER, transaction.time);
+    record.walletId = senderId;
+    record.otherWalletId = receiverId;
+    record.amount = grnCoins;
+
+    // Only the ledger slot and the journal order are serialized; balances stay under the shard locks
+    bool syncDue = false;
+    size_t position;
+    {
+        std::lock_guard<std::mutex> ledgerLock(server.ledgerMutex);
+        if (!reserveTransactions(system.transactions, 1) || !writeJournalRecord(system.journal, record, "", syncDue)) {
+            return false;
+        }
+        appendLedgerRecord(system.transactions, transaction);
+        position = ledgerSize(system.transactions) - 1;
+        system.leaderboard.valid = false;
+    }
+    applyTransaction(system, system.wallets.coins, transaction);
+    if (system.wallets.historiesIndexed) {
+        indexTransaction(system, transaction, position);
+    }
+
+    if (secondLock.owns_lock()) {
+        secondLock.unlock();
+    }
+    firstLock.unlock();
+    walletsLock.unlock();
+    sequence = record.sequence;
+    return !syncDue || syncJournal(system.journal);
+}
+
+void serverWalletInfo(Server& server, const unsigned walletId, std::ostream& output) {
+    std::shared_lock<std::shared_mutex> walletsLock(server.walletsMutex);
+    std::lock_guard<std::mutex> shardLock(server.walletShards[walletShard(walletId)]);
+    walletInfo(*server.system, walletId, output);
+}
+
+void runSequencer(Server& server) {
+    while (true) {
+        SequencedCommand* command = nullptr;
+        long long window = server.system->journal.groupCommitWindow;
+        bool received = popServerQueue(server.commands, command, window > 0 ? window : 1);
+        if (received && command == nullptr) {
+            return;
+        }
 
-    bool exit = false;
-    while(!exit) {
-        if (strcmp(command, "add-wallet")==0) {
-            double fiatMoney;
+        std::unique_lock<std::shared_mutex> walletsLock(server.walletsMutex);
+        if (received) {
+            std::istringstream input(command->line);
             char name[MAX_INPUT_LENGTH];
-            std::cin >> fiatMoney >> name;
-            long long result = addWallet(system, fiatMoney, name);
-            if (result!=-1) {
-                std::cout << "Successfully added wallet with ID " << result << std::endl;
+            if (input >> name) {
+                executeCommand(*server.system, name, input, *command->output);
             }
-            else {
-                std::cout << "Could not add wallet" << std::endl;
+            command->sequence = journalSequence(server.system->journal);
+        }
+        else {
+            syncJournal(server.system->journal);
+        }
+        checkpointIfDue(*server.system);
+        walletsLock.unlock();
+
+        if (received) {
+            std::lock_guard<std::mutex> completedLock(server.completedMutex);
+            command->done = true;
+            server.completed.notify_all();
+        }
+    }
+}
+
+// Raises sequence to the last journal record the command depends on; its reply must wait for that commit
+bool serveCommand(Server& server, const char line[], std::ostream& output, unsigned long long& sequence) {
+    std::istringstream input(line);
+    char command[MAX_INPUT_LENGTH];
+    if (!(input >> command)) {
+        return true;
+    }
+
+    if (strcmp(command, "transfer") == 0) {
+        unsigned senderId, receiverId;
+        double grnCoins;
+        if (input >> senderId >> receiverId >> grnCoins && serverTransfer(server, senderId, receiverId, grnCoins, sequence)) {
+            output << "Successful transfer" << std::endl;
+        }
+        else {
+            output << "Unsuccessful transfer" << std::endl;
+        }
+    }
+    else if (strcmp(command, "wallet-info") == 0) {
+        unsigned walletId = 0;
+        input >> walletId;
+        serverWalletInfo(server, walletId, output);
+    }
+    else if (strcmp(command, "quit") == 0) {
+        return false;
+    }
+    else {
+        SequencedCommand sequenced;
+        sequenced.line = line;
+        sequenced.output = &output;
+        sequenced.sequence = 0;
+        sequenced.done = false;
+        pushServerQueue(server.commands, &sequenced);
+        std::unique_lock<std::mutex> completedLock(server.completedMutex);
+        server.completed.wait(completedLock, [&sequenced] { return sequenced.done; });
+        sequence = std::max(sequence, sequenced.sequence);
+    }
+    return true;
+}
+
+bool sendResponse(const int fd, const std::string& response) {
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t written = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd writable = { fd, POLLOUT, 0 };
+            poll(&writable, 1, -1);
+        }
+        else if (written < 0 && errno != EINTR) {
+            return false;
+        }
+        else if (written > 0) {
+            sent += written;
+        }
+    }
+    return true;
+}
+
+void serveConnection(Server& server, Connection* connection) {
+    bool open = true;
+    while (open) {
+        ssize_t received = recv(connection->fd, connection->buffer + connection->length,
+            CONNECTION_BUFFER_SIZE - connection->length, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (received <= 0) {
+            open = false;
+            break;
+        }
+
+        connection->length += received;
+        std::ostringstream output;
+        unsigned long long sequence = 0;
+        char* line = connection->buffer;
+        char* newline;
+        while (open && (newline = (char*)memchr(line, '\n', connection->buffer + connection->length - line)) != nullptr) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') {
+                newline[-1] = '\0';
             }
+            open = serveCommand(server, line, output, sequence);
+            line = newline + 1;
         }
-        else if (strcmp(command, "make-order")==0) {
-            char type[MAX_INPUT_LENGTH];
-            double grnCoins;
-            unsigned walletId;
-            std::cin >> type >> grnCoins >> walletId;
-            if (strcmp(type, "buy")==0) {
-                if (addOrder(system, walletId, Order::Type::BUY, grnCoins)) {
-                    std::cout << "Successfully added order" << std::endl;
-                }
-                else {
-                    std::cout << "Could not add order" << std::endl;
-                }
+        connection->length -= line - connection->buffer;
+        memmove(connection->buffer, line, connection->length);
+        if (connection->length == CONNECTION_BUFFER_SIZE) {
+            output << "Command is too long" << std::endl;
+            open = false;
+        }
+        // Replies are acknowledgements, so the whole chunk waits for one group commit and the sequencer never does
+        if (!waitForJournal(server.system->journal, sequence)) {
+            output.str(std::string());
+            output << "Could not write to " << JOURNAL_FILENAME << std::endl;
+            open = false;
+        }
+        if (!sendResponse(connection->fd, output.str())) {
+            open = false;
+        }
+    }
+
+    if (open) {
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = connection;
+        epoll_ctl(server.epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+    }
+    else {
+        epoll_ctl(server.epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+        close(connection->fd);
+        delete connection;
+    }
+}
+
+void runWorker(Server& server) {
+    Connection* connection;
+    while (popServerQueue(server.connections, connection, -1) && connection != nullptr) {
+        serveConnection(server, connection);
+    }
+}
+
+int openListener(const StartupOptions& options) {
+    int fd;
+    if (options.socketPath != nullptr) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(options.socketPath) >= sizeof(address.sun_path)) {
+            return -1;
+        }
+        strcpy(address.sun_path, options.socketPath);
+        struct stat status;
+        if (stat(options.socketPath, &status) == 0 && S_ISSOCK(status.st_mode)) {
+            unlink(options.socketPath);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            return -1;
+        }
+    }
+    else {
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((unsigned short)options.listenPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int reuse = 1;
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+            bind(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void acceptConnections(Server& server) {
+    int fd;
+    while ((fd = accept4(server.listener.fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1) {
+        Connection* connection = new (std::nothrow) Connection;
+        if (connection == nullptr) {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->length = 0;
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = connection;
+        epoll_ctl(server.epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+bool runServer(System& system, const StartupOptions& options) {
+    Server* server = new (std::nothrow) Server;
+    server->system = &system;
+    server->connections.head = server->connections.count = 0;
+    server->commands.head = server->commands.count = 0;
+    server->listener.fd = openListener(options);
+    if (server->listener.fd == -1) {
+        std::cout << "Could not open the server socket" << std::endl;
+        delete server;
+        return false;
+    }
+
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    server->signals.fd = signalfd(-1, &stopSignals, SFD_NONBLOCK);
+
+    server->epollFd = epoll_create1(0);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &server->listener;
+    epoll_ctl(server->epollFd, EPOLL_CTL_ADD, server->listener.fd, &event);
+    event.data.ptr = &server->signals;
+    epoll_ctl(server->epollFd, EPOLL_CTL_ADD, server->signals.fd, &event);
+
+    size_t workerCount = options.threads > 0 ? options.threads : 1;
+    system.journal.deferCommit = true;
+    std::thread sequencer(runSequencer, std::ref(*server));
+    std::thread* workers = new (std::nothrow) std::thread[workerCount];
+    for (size_t i = 0; i < workerCount; i++) {
+        workers[i] = std::thread(runWorker, std::ref(*server));
+    }
+    if (options.socketPath != nullptr) {
+        std::cout << "Listening on " << options.socketPath << " with " << workerCount << " workers" << std::endl;
+    }
+    else {
+        std::cout << "Listening on 127.0.0.1:" << options.listenPort << " with " << workerCount << " workers" << std::endl;
+    }
+
+    bool running = true;
+    epoll_event events[MAX_SERVER_EVENTS];
+    while (running) {
+        int eventCount = epoll_wait(server->epollFd, events, MAX_SERVER_EVENTS, -1);
+        for (int i = 0; i < eventCount; i++) {
+            if (events[i].data.ptr == &server->listener) {
+                acceptConnections(*server);
             }
-            else if (strcmp(type, "sell")==0) {
-                if (addOrder(system, walletId, Order::Type::SELL, grnCoins)) {
-                    std::cout << "Successfully added order" << std::endl;
-                }
-                else {
-                    std::cout << "Could not add order" << std::endl;
-                }
+            else if (events[i].data.ptr == &server->signals) {
+                running = false;
             }
             else {
-                std::cout << "Invalid type of order" << std::endl;
+                pushServerQueue(server->connections, (Connection*)events[i].data.ptr);
             }
         }
-        else if (strcmp(command, "transfer")==0) {
-            unsigned senderId, receiverId;
-            double grnCoins;
-            std::cin >> senderId >> receiverId >> grnCoins;
-            if (transfer(system, senderId, receiverId, grnCoins)) {
-                std::cout << "Successful transfer" << std::endl;
-            }
-            else {
-                std::cout << "Unsuccessful transfer" << std::endl;
-            }
+    }
+
+    close(server->listener.fd);
+    if (options.socketPath != nullptr) {
+        unlink(options.socketPath);
+    }
+    for (size_t i = 0; i < workerCount; i++) {
+        pushServerQueue(server->connections, (Connection*)nullptr);
+    }
+    for (size_t i = 0; i < workerCount; i++) {
+        workers[i].join();
+    }
+    pushServerQueue(server->commands, (SequencedCommand*)nullptr);
+    sequencer.join();
+    close(server->signals.fd);
+    close(server->epollFd);
+    delete[] workers;
+    delete server;
+    return true;
+}
+#endif
+
+#ifndef EXCHANGE_NO_MAIN
+int main(int argc, char* argv[])
+{
+    StartupOptions options;
+    options.threads = std::thread::hardware_concurrency();
+    options.validateLedger = false;
+    options.groupCommitCount = GROUP_COMMIT_COUNT;
+    options.groupCommitWindow = GROUP_COMMIT_WINDOW;
+    options.checkpointInterval = 0;
+    options.listenPort = 0;
+    options.socketPath = nullptr;
+    options.batchFilename = nullptr;
+    options.statsFilename = nullptr;
+    options.idStrategy = IdAllocator::Strategy::RANDOM;
+    options.seeded = false;
+    options.idSeed = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--validate-ledger") == 0) {
+            options.validateLedger = true;
+        }
+        else if (i + 1 == argc) {
+            break;
+        }
+        else if (strcmp(argv[i], "--threads") == 0) {
+            options.threads = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--group-commit-count") == 0) {
+            options.groupCommitCount = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--group-commit-window") == 0) {
+            options.groupCommitWindow = strtoll(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0) {
+            options.checkpointInterval = strtoll(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--listen") == 0) {
+            options.listenPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--socket") == 0) {
+            options.socketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--batch") == 0) {
+            options.batchFilename = argv[++i];
         }
-        else if (strcmp(command, "wallet-info")==0) {
-            unsigned walletId;
-            std::cin >> walletId;
-            walletInfo(system, walletId);
+        else if (strcmp(argv[i], "--id-allocator") == 0) {
+            options.idStrategy = strcmp(argv[++i], "counter") == 0 ? IdAllocator::Strategy::COUNTER : IdAllocator::Strategy::RANDOM;
         }
-        else if (strcmp(command, "attract-investors")==0) {
-            attractInvestors(system);
+        else if (strcmp(argv[i], "--stats-json") == 0) {
+            options.statsFilename = argv[++i];
         }
-        else if (strcmp(command, "quit")==0) {
+        else if (strcmp(argv[i], "--id-seed") == 0) {
+            options.seeded = true;
+            options.idSeed = strtoull(argv[++i], nullptr, 10);
+        }
+    }
+#ifndef EXCHANGE_SERVER
+    if (options.listenPort != 0 || options.socketPath != nullptr) {
+        std::cout << "Server mode is not supported on this platform" << std::endl;
+        return 1;
+    }
+#endif
+
+    System system;
+    loadSystem(system, options);
+
+    int status = 0;
+    if (options.batchFilename != nullptr) {
+        status = runBatch(system, options.batchFilename) ? 0 : 1;
+    }
+#ifdef EXCHANGE_SERVER
+    else if (options.listenPort != 0 || options.socketPath != nullptr) {
+        if (runServer(system, options)) {
+            std::cout << "Server stopped" << std::endl;
             if (quit(system)) {
                 std::cout << "Successfully saved data" << std::endl;
             }
             else {
                 std::cout << "Could not save data" << std::endl;
             }
-            exit = true;
-            return 0;
         }
+        else {
+            status = 1;
+        }
+    }
+#endif
+    else {
+        std::cout << "Welcome" << std::endl << std::endl;
+        displayCommands();
+        std::cout << std::endl;
 
+        char command[MAX_INPUT_LENGTH];
         std::cin >> command;
+
+        while(executeCommand(system, command, std::cin, std::cout)) {
+            checkpointIfDue(system);
+            std::cin >> command;
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    if (!releaseSystem(system)) {
+        status = 1;
+    }
+    if (options.statsFilename != nullptr && !writeStatsJson(options.statsFilename)) {
+        std::cout << "Could not write statistics to " << options.statsFilename << std::endl;
+    }
+    return status;
+}
+#endif
\ No newline at end of file